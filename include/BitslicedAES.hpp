@@ -0,0 +1,29 @@
+#ifndef __BITSLICED_AES_H_INCLUDED__
+#define __BITSLICED_AES_H_INCLUDED__
+
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief A constant-time bitsliced software AES-128 engine, used when AES-NI is unavailable.
+ * 
+ * Blocks are processed 8 at a time with SSE2, or 16 at a time with AVX2 when the CPU supports it,
+ * using only bitwise operations and fixed shifts, so there are no key or data dependent table lookups.
+ * Instances are stateless once built and can be shared by several threads.
+ */
+class BitslicedAES
+{
+    private:
+        uint64_t round_keys[88];
+        bool avx2 = false;
+
+    public:
+        explicit BitslicedAES(const uint8_t* key_schedule) noexcept;
+        static void key_expansion(const uint8_t* key, uint8_t* key_schedule) noexcept;
+
+        std::size_t blocks_per_pass() const noexcept;
+        void encrypt_blocks(const uint8_t* src, uint8_t* dest, std::size_t blocks) const noexcept;
+        void decrypt_blocks(const uint8_t* src, uint8_t* dest, std::size_t blocks) const noexcept;
+};
+
+#endif // __BITSLICED_AES_H_INCLUDED__
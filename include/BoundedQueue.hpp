@@ -0,0 +1,78 @@
+#ifndef __BOUNDED_QUEUE_H_INCLUDED__
+#define __BOUNDED_QUEUE_H_INCLUDED__
+
+#include <queue>
+#include <mutex>
+#include <cstddef>
+#include <condition_variable>
+
+/**
+ * @brief A blocking FIFO queue with a fixed capacity, used to hand work between pipeline stages.
+ *
+ * push() blocks while the queue is full and pop() blocks while it is empty, so a fast
+ * producer can never run ahead of a slow consumer by more than the queue capacity.
+ * Once closed, push() fails and pop() only drains the remaining items.
+ */
+template <typename T>
+class BoundedQueue
+{
+    private:
+        std::queue<T> items;
+        const std::size_t capacity;
+        bool closed = false;
+
+        std::mutex mtx;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+
+    public:
+        explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+        /**
+         * @brief Appends an item, waiting for a free slot if the queue is full.
+         *
+         * @return false if the queue has been closed, true otherwise.
+         */
+        bool push(T item)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            not_full.wait(lock, [this] { return closed or items.size() < capacity; });
+            if (closed)
+                return false;
+
+            items.push(std::move(item));
+            not_empty.notify_one();
+            return true;
+        }
+
+        /**
+         * @brief Removes the oldest item, waiting for one to be available if the queue is empty.
+         *
+         * @return false if the queue is closed and fully drained, true otherwise.
+         */
+        bool pop(T& item)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            not_empty.wait(lock, [this] { return closed or not items.empty(); });
+            if (items.empty())
+                return false;
+
+            item = std::move(items.front());
+            items.pop();
+            not_full.notify_one();
+            return true;
+        }
+
+        /**
+         * @brief Closes the queue and wakes up every waiting producer and consumer.
+         */
+        void close()
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            closed = true;
+            not_empty.notify_all();
+            not_full.notify_all();
+        }
+};
+
+#endif // __BOUNDED_QUEUE_H_INCLUDED__
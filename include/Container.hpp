@@ -0,0 +1,122 @@
+#ifndef __CONTAINER_H_INCLUDED__
+#define __CONTAINER_H_INCLUDED__
+
+#include <array>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdint>
+
+#include "FastAES.hpp"
+
+/**
+ * @brief Seekable chunked container format.
+ *
+ * The plaintext is cut into fixed-size chunks, each one encrypted on its own with AES-CTR under
+ * a per-chunk IV, so that any byte range can be decrypted by touching only the chunks it covers.
+ * All integers are little-endian.
+ *
+ *   header  : magic "SMAESCT1" | u32 version | u32 flags | u32 chunk_size | u32 reserved | u8 nonce[8]
+ *   chunks  : ciphertext of every chunk, back to back
+ *   index   : one entry per chunk, u8 iv[16] | u64 offset | u32 length | u32 reserved [| u8 tag[16]]
+ *   [index tag : u8 tag[16]]
+ *   footer  : u64 index_offset | u64 chunk_count | u64 plaintext_size | magic "SMAESIX1"
+ *
+ * The IV of chunk i is nonce | be32(i) | be32(0), readers reject any other one. When FLAG_TAGGED is set,
+ * every index entry carries the AES-CMAC of iv | ciphertext under a key derived from the container key,
+ * and the index tag is the AES-CMAC of header | index | footer under the same key. The index tag binds
+ * the chunk tags to their position and to the chunk count, so reordered, dropped or appended chunks are
+ * rejected by open() before any chunk is read.
+ */
+namespace Container
+{
+    constexpr std::size_t HEADER_SIZE = 32;
+    constexpr std::size_t FOOTER_SIZE = 32;
+    constexpr std::size_t TAG_SIZE = 16;
+    constexpr std::size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+    constexpr uint32_t VERSION = 1;
+    constexpr uint32_t FLAG_TAGGED = 1;
+
+    /**
+     * @brief Outcome of a container operation.
+     */
+    enum class STATUS {OK, ALLOC_ERROR, READ_ERROR, WRITE_ERROR, BAD_FORMAT, BAD_RANGE, BAD_TAG};
+
+    /**
+     * @brief Index entry describing one encrypted chunk.
+     */
+    struct Entry
+    {
+        std::array<uint8_t, 16> iv;
+        uint64_t offset;
+        uint32_t length;
+        std::array<uint8_t, 16> tag;
+    };
+}
+
+/**
+ * @brief Writes a container sequentially to a file descriptor, which may be a pipe.
+ */
+class ContainerWriter
+{
+    private:
+        FastAES& aes;
+        std::unique_ptr<FastAES> mac_aes;
+        const int fd;
+        const uint32_t chunk_size;
+        const bool tagged;
+        const uint32_t num_threads;
+
+        std::array<uint8_t, 8> nonce;
+        uint8_t header[Container::HEADER_SIZE];
+        std::unique_ptr<uint8_t[]> buffer;
+        std::size_t buffered = 0;
+        uint64_t offset = 0;
+        uint64_t plaintext_size = 0;
+        std::vector<Container::Entry> index;
+        bool started = false;
+
+        Container::STATUS start() noexcept;
+        Container::STATUS flush_chunk() noexcept;
+
+    public:
+        ContainerWriter(FastAES& aes, int fd, uint32_t chunk_size=Container::DEFAULT_CHUNK_SIZE, bool tagged=false, uint32_t num_threads=std::thread::hardware_concurrency());
+
+        Container::STATUS write(const uint8_t* data, std::size_t length) noexcept;
+        Container::STATUS finish() noexcept;
+};
+
+/**
+ * @brief Random-access reader of a container stored in a seekable file.
+ *
+ * Chunks are fetched with positional reads, so reads of distinct ranges are decrypted in parallel
+ * by worker threads without sharing a file position.
+ */
+class ContainerReader
+{
+    private:
+        FastAES& aes;
+        std::unique_ptr<FastAES> mac_aes;
+        const int fd;
+        const uint32_t num_threads;
+
+        uint32_t chunk_size = 0;
+        bool tagged = false;
+        uint64_t plaintext_size = 0;
+        std::vector<Container::Entry> index;
+
+        Container::STATUS read_chunk(std::size_t chunk, uint64_t begin, uint64_t end, uint8_t* dest, uint8_t* buffer, uint32_t threads) noexcept;
+
+    public:
+        ContainerReader(FastAES& aes, int fd, uint32_t num_threads=std::thread::hardware_concurrency());
+
+        Container::STATUS open() noexcept;
+        Container::STATUS read(uint64_t offset, uint8_t* dest, std::size_t length) noexcept;
+
+        uint64_t size() const noexcept { return plaintext_size; }
+        uint32_t get_chunk_size() const noexcept { return chunk_size; }
+        std::size_t chunk_count() const noexcept { return index.size(); }
+};
+
+#endif // __CONTAINER_H_INCLUDED__
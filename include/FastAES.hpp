@@ -7,12 +7,15 @@
 #include <thread>
 #include <cstdint>
 
+#include "BitslicedAES.hpp"
+
 /**
  * @brief A class for fast AES encryption and decryption using hardware acceleration.
  * 
  * This class utilizes AES-NI (AES New Instructions) available in modern CPUs
  * for efficient AES encryption and decryption. It supports multithreading to
- * parallelize the encryption and decryption process.
+ * parallelize the encryption and decryption process. When AES-NI is unavailable,
+ * or when requested, a constant-time bitsliced software engine is used instead.
  */
 class FastAES
 {
@@ -20,13 +23,22 @@ class FastAES
         const uint8_t* key = nullptr;
         std::unique_ptr<uint8_t> enc_key_schedule;
         std::unique_ptr<uint8_t> dec_key_schedule;
+        alignas(16) uint8_t cmac_subkeys[32];
+        std::unique_ptr<BitslicedAES> bitsliced;
 
         void key_expansion(uint8_t* enc_key_schedule, uint8_t* dec_key_schedule) noexcept;
+        void ctr_process(const uint8_t* src, uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset, uint32_t num_threads) noexcept;
 
     public:
+        /**
+         * @brief Enumeration for selecting the AES engine, AUTO picks AES-NI when the CPU supports it.
+         */
+        enum class ENGINE {AUTO, AESNI, BITSLICED};
+
         ~FastAES();
-        FastAES(const uint8_t* key);
+        FastAES(const uint8_t* key, ENGINE engine=ENGINE::AUTO);
         inline bool supports_aes() const noexcept;
+        ENGINE get_engine() const noexcept;
 
         /**
          * @brief Enumeration for specifying the encryption mode.
@@ -35,6 +47,11 @@ class FastAES
         void encrypt(const uint8_t* src, uint8_t* dest, std::size_t length, uint32_t num_threads=std::thread::hardware_concurrency(), const ENC_MODE mode= ENC_MODE::ECB) noexcept;
         void decrypt(const uint8_t* src, uint8_t* dest, std::size_t length, uint32_t num_threads=std::thread::hardware_concurrency(), const ENC_MODE mode= ENC_MODE::ECB) noexcept;
 
+        void ctr_crypt(const uint8_t* src, uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset=0, uint32_t num_threads=std::thread::hardware_concurrency()) noexcept;
+        void generate_keystream(uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset=0, uint32_t num_threads=std::thread::hardware_concurrency()) noexcept;
+        void cmac(const uint8_t* msg, std::size_t length, uint8_t* tag) noexcept;
+        void cmac_batch(const uint8_t* const* msgs, const std::size_t* lengths, std::size_t count, uint8_t* tags, uint32_t num_threads=std::thread::hardware_concurrency()) noexcept;
+
 };
 
 #endif // __FAST_AES_H_INCLUDED__
\ No newline at end of file
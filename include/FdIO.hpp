@@ -0,0 +1,12 @@
+#ifndef __FD_IO_H_INCLUDED__
+#define __FD_IO_H_INCLUDED__
+
+#include <cstdint>
+#include <cstddef>
+
+long long read_full(int fd, uint8_t* buffer, std::size_t length) noexcept;
+long long pread_full(int fd, uint8_t* buffer, std::size_t length, uint64_t offset) noexcept;
+bool write_full(int fd, const uint8_t* buffer, std::size_t length) noexcept;
+long long file_size(int fd) noexcept;
+
+#endif // __FD_IO_H_INCLUDED__
@@ -0,0 +1,63 @@
+#ifndef __STREAM_PIPELINE_H_INCLUDED__
+#define __STREAM_PIPELINE_H_INCLUDED__
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <cstdint>
+
+#include "FastAES.hpp"
+#include "BoundedQueue.hpp"
+
+/**
+ * @brief Streams data between two file descriptors through a FastAES instance in fixed-size chunks.
+ *
+ * The input is consumed by a reader thread, encrypted or decrypted on the calling thread
+ * and emitted by a writer thread, with bounded queues between the three stages. A fixed
+ * pool of chunk buffers is recycled from the writer back to the reader, so memory usage
+ * stays constant whatever the stream length. Only sequential read()/write() calls are
+ * issued, which makes it suitable for non-seekable inputs and outputs such as pipes.
+ * The stream is PKCS5 padded on encryption and unpadded on decryption.
+ */
+class StreamPipeline
+{
+    public:
+        /**
+         * @brief Outcome of a pipeline run.
+         */
+        enum class STATUS {OK, ALLOC_ERROR, READ_ERROR, WRITE_ERROR, BAD_LENGTH, BAD_PADDING};
+
+        static constexpr std::size_t DEFAULT_CHUNK_SIZE = 4 * 1024 * 1024;
+        static constexpr std::size_t DEFAULT_DEPTH = 4;
+
+        StreamPipeline(FastAES& aes, int in_fd, int out_fd, std::size_t chunk_size=DEFAULT_CHUNK_SIZE, std::size_t depth=DEFAULT_DEPTH, uint32_t num_threads=std::thread::hardware_concurrency());
+
+        STATUS encrypt();
+        STATUS decrypt();
+
+    private:
+        struct Chunk
+        {
+            std::unique_ptr<uint8_t[]> data;
+            std::size_t length = 0;
+            bool last = false;
+        };
+
+        FastAES& aes;
+        const int in_fd;
+        const int out_fd;
+        const std::size_t chunk_size;
+        const std::size_t depth;
+        const uint32_t num_threads;
+
+        std::vector<Chunk> pool;
+        std::atomic<int> status;
+
+        STATUS run(bool encrypt);
+        void fail(STATUS reason, BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept;
+        void read_stage(BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept;
+        void write_stage(BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept;
+};
+
+#endif // __STREAM_PIPELINE_H_INCLUDED__
@@ -0,0 +1,105 @@
+#ifndef __URING_FILE_ENGINE_H_INCLUDED__
+#define __URING_FILE_ENGINE_H_INCLUDED__
+
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <cstdint>
+
+#include "FastAES.hpp"
+#include "BoundedQueue.hpp"
+
+struct iovec;
+
+/**
+ * @brief Encrypts or decrypts a file into another one through io_uring, bypassing the page cache with O_DIRECT.
+ *
+ * Both files are processed in fixed-size chunks held in page-aligned buffers registered with the ring.
+ * The calling thread keeps the reads and writes of every buffer in flight and reaps their completions,
+ * while worker threads encrypt or decrypt each chunk as soon as it is read and queue its write.
+ * The output is the same as the buffered file mode, raw ECB cyphertext with PKCS5 padding.
+ *
+ * Only available on Linux. When the kernel has no io_uring support, run() returns STATUS::UNAVAILABLE
+ * before touching any file so that the caller can fall back to another engine. A filesystem refusing
+ * O_DIRECT, or a buffer registration exceeding the locked memory limit, are handled internally by
+ * falling back to buffered I/O and unregistered buffers.
+ */
+class UringFileEngine
+{
+    public:
+        /**
+         * @brief Outcome of a run.
+         */
+        enum class STATUS {OK, UNAVAILABLE, ALLOC_ERROR, INPUT_OPEN_ERROR, OUTPUT_OPEN_ERROR, READ_ERROR, WRITE_ERROR, BAD_LENGTH, BAD_PADDING};
+
+        static constexpr std::size_t DEFAULT_CHUNK_SIZE = 1024 * 1024;
+        static constexpr std::size_t ALIGNMENT = 4096;
+
+        UringFileEngine(FastAES& aes, const char* in_path, const char* out_path, uint32_t num_threads=std::thread::hardware_concurrency(), std::size_t chunk_size=DEFAULT_CHUNK_SIZE);
+        ~UringFileEngine();
+
+        STATUS encrypt();
+        STATUS decrypt();
+
+    private:
+        enum class SLOT_STATE {READING, PROCESSING, WRITING};
+
+        struct Slot
+        {
+            uint8_t* data = nullptr;
+            uint64_t offset = 0;
+            std::size_t length = 0;
+            std::size_t io_done = 0;
+            bool last = false;
+            SLOT_STATE state = SLOT_STATE::READING;
+        };
+
+        FastAES& aes;
+        const char* in_path;
+        const char* out_path;
+        const uint32_t num_threads;
+        const std::size_t chunk_size;
+        const std::size_t depth;
+
+        int ring_fd = -1;
+        int wake_fd = -1;
+        int in_fd = -1;
+        int out_fd = -1;
+        bool fixed_buffers = false;
+
+        // shared ring mappings, laid out as described by the offsets io_uring_setup() returns
+        void* sq_ring = nullptr;
+        void* cq_ring = nullptr;
+        void* sqes = nullptr;
+        std::size_t sq_ring_size = 0;
+        std::size_t cq_ring_size = 0;
+        std::size_t sqes_size = 0;
+        unsigned* sq_tail = nullptr;
+        unsigned* sq_mask = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        unsigned* cq_mask = nullptr;
+        void* cqes = nullptr;
+
+        uint8_t* buffers = nullptr;
+        bool leak_buffers = false;
+        iovec* iovecs = nullptr;
+        std::vector<Slot> slots;
+        std::mutex submit_mutex;
+        std::atomic<int> status;
+        std::atomic<std::size_t> inflight;
+        std::size_t padding = 0;
+
+        bool setup_ring() noexcept;
+        void release() noexcept;
+        void fail(STATUS reason) noexcept;
+        bool submit(uint8_t opcode, std::size_t slot, int fd, uint8_t* buffer, std::size_t length, uint64_t offset) noexcept;
+        bool reap(uint64_t& slot, int& result, bool wakeable) noexcept;
+        bool submit_io(std::size_t slot) noexcept;
+        void process_stage(BoundedQueue<std::size_t>& filled_q, bool encrypt) noexcept;
+        STATUS run(bool encrypt);
+};
+
+#endif // __URING_FILE_ENGINE_H_INCLUDED__
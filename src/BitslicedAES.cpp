@@ -0,0 +1,90 @@
+#include "BitslicedKernel.hpp"
+#include "../include/BitslicedAES.hpp"
+
+/**
+ * @brief Applies the S-box to the 4 bytes of a word, in constant time.
+ */
+static uint32_t sub_word(uint32_t x) noexcept
+{
+    uint64_t q[8] = {x, 0, 0, 0, 0, 0, 0, 0};
+    ortho(q);
+    sbox(q);
+    ortho(q);
+    return static_cast<uint32_t>(q[0]);
+}
+
+/**
+ * @brief Constructs the engine from an expanded key schedule.
+ * 
+ * @param key_schedule The 11 round keys (176 bytes), as laid out by key_expansion().
+ */
+BitslicedAES::BitslicedAES(const uint8_t* key_schedule) noexcept
+{
+    // every round key is sliced as if it was the key of 4 blocks, ready to be xored with a slice
+    for (int round = 0; round < 11; ++round)
+    {
+        uint32_t w[4];
+        std::memcpy(w, key_schedule + 16 * round, 16);
+
+        uint64_t* q = round_keys + 8 * round;
+        for (int i = 0; i < 4; ++i)
+            interleave_in(&q[i], &q[i + 4], w);
+        ortho(q);
+    }
+
+#ifndef _WIN32
+    avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+/**
+ * @brief Expands a 128-bit key into the 11 round keys, without AES-NI and in constant time.
+ * 
+ * @param key The encryption key as a 128-bit (16 bytes) array.
+ * @param key_schedule Pointer to the 176 bytes receiving the round keys, in the same layout as the AES-NI key schedule.
+ */
+void BitslicedAES::key_expansion(const uint8_t* key, uint8_t* key_schedule) noexcept
+{
+    static const uint32_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+
+    uint32_t w[44];
+    std::memcpy(w, key, 16);
+    for (int i = 4; i < 44; ++i)
+    {
+        uint32_t tmp = w[i - 1];
+        if (i % 4 == 0)
+            tmp = sub_word((tmp << 24) | (tmp >> 8)) ^ rcon[i / 4 - 1];
+        w[i] = w[i - 4] ^ tmp;
+    }
+    std::memcpy(key_schedule, w, sizeof(w));
+}
+
+/**
+ * @brief Returns the number of blocks processed per pass, callers should hand over multiples of it.
+ */
+std::size_t BitslicedAES::blocks_per_pass() const noexcept
+{
+    return avx2 ? 16 : 8;
+}
+
+/**
+ * @brief Encrypts consecutive blocks, src may be equal to dest.
+ */
+void BitslicedAES::encrypt_blocks(const uint8_t* src, uint8_t* dest, std::size_t blocks) const noexcept
+{
+    if (avx2)
+        bitsliced_process_avx2(round_keys, src, dest, blocks, false);
+    else
+        process_blocks<__m128i>(round_keys, src, dest, blocks, false);
+}
+
+/**
+ * @brief Decrypts consecutive blocks, src may be equal to dest.
+ */
+void BitslicedAES::decrypt_blocks(const uint8_t* src, uint8_t* dest, std::size_t blocks) const noexcept
+{
+    if (avx2)
+        bitsliced_process_avx2(round_keys, src, dest, blocks, true);
+    else
+        process_blocks<__m128i>(round_keys, src, dest, blocks, true);
+}
@@ -0,0 +1,7 @@
+// compiled with -mavx2, only called once the CPU has been checked for AVX2 support
+#include "BitslicedKernel.hpp"
+
+void bitsliced_process_avx2(const uint64_t* round_keys, const uint8_t* src, uint8_t* dest, std::size_t blocks, bool decrypt) noexcept
+{
+    process_blocks<__m256i>(round_keys, src, dest, blocks, decrypt);
+}
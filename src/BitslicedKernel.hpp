@@ -0,0 +1,483 @@
+#ifndef __BITSLICED_KERNEL_H_INCLUDED__
+#define __BITSLICED_KERNEL_H_INCLUDED__
+
+/*
+ * Private header shared by BitslicedAES.cpp (SSE2) and BitslicedAES_avx2.cpp (AVX2).
+ *
+ * Every 64-bit word holds one bit slice of 4 blocks, as in the BearSSL "ct64" representation, and
+ * a vector register of L 64-bit lanes processes 4 * L blocks at once. Only bitwise operations and
+ * fixed shifts are used, so the running time doesn't depend on the key or the data.
+ */
+
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+#include <emmintrin.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// plain 64-bit words, used for the key schedule
+static inline uint64_t vxor(uint64_t a, uint64_t b) noexcept { return a ^ b; }
+static inline uint64_t vand(uint64_t a, uint64_t b) noexcept { return a & b; }
+static inline uint64_t vor(uint64_t a, uint64_t b) noexcept { return a | b; }
+static inline uint64_t vnot(uint64_t a) noexcept { return ~a; }
+static inline uint64_t vrotr32(uint64_t a) noexcept { return (a << 32) | (a >> 32); }
+template <int N> static inline uint64_t vshl(uint64_t a) noexcept { return a << N; }
+template <int N> static inline uint64_t vshr(uint64_t a) noexcept { return a >> N; }
+
+static inline __m128i vxor(__m128i a, __m128i b) noexcept { return _mm_xor_si128(a, b); }
+static inline __m128i vand(__m128i a, __m128i b) noexcept { return _mm_and_si128(a, b); }
+static inline __m128i vor(__m128i a, __m128i b) noexcept { return _mm_or_si128(a, b); }
+static inline __m128i vnot(__m128i a) noexcept { return _mm_xor_si128(a, _mm_set1_epi32(-1)); }
+static inline __m128i vset1(uint64_t x) noexcept { return _mm_set1_epi64x(static_cast<long long>(x)); }
+static inline __m128i vrotr32(__m128i a) noexcept { return _mm_shuffle_epi32(a, 0xB1); }
+template <int N> static inline __m128i vshl(__m128i a) noexcept { return _mm_slli_epi64(a, N); }
+template <int N> static inline __m128i vshr(__m128i a) noexcept { return _mm_srli_epi64(a, N); }
+static inline void vstore(uint64_t* p, __m128i a) noexcept { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), a); }
+static inline __m128i vload(const uint64_t* p) noexcept { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+
+#ifdef __AVX2__
+static inline __m256i vxor(__m256i a, __m256i b) noexcept { return _mm256_xor_si256(a, b); }
+static inline __m256i vand(__m256i a, __m256i b) noexcept { return _mm256_and_si256(a, b); }
+static inline __m256i vor(__m256i a, __m256i b) noexcept { return _mm256_or_si256(a, b); }
+static inline __m256i vnot(__m256i a) noexcept { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+static inline __m256i vset1_256(uint64_t x) noexcept { return _mm256_set1_epi64x(static_cast<long long>(x)); }
+static inline __m256i vrotr32(__m256i a) noexcept { return _mm256_shuffle_epi32(a, 0xB1); }
+template <int N> static inline __m256i vshl(__m256i a) noexcept { return _mm256_slli_epi64(a, N); }
+template <int N> static inline __m256i vshr(__m256i a) noexcept { return _mm256_srli_epi64(a, N); }
+static inline void vstore(uint64_t* p, __m256i a) noexcept { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a); }
+static inline __m256i vload_256(const uint64_t* p) noexcept { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+#endif
+
+template <typename V> static inline V vbroadcast(uint64_t x) noexcept;
+template <typename V> static inline V vloadu(const uint64_t* p) noexcept;
+template <> inline uint64_t vbroadcast<uint64_t>(uint64_t x) noexcept { return x; }
+template <> inline __m128i vbroadcast<__m128i>(uint64_t x) noexcept { return vset1(x); }
+template <> inline __m128i vloadu<__m128i>(const uint64_t* p) noexcept { return vload(p); }
+#ifdef __AVX2__
+template <> inline __m256i vbroadcast<__m256i>(uint64_t x) noexcept { return vset1_256(x); }
+template <> inline __m256i vloadu<__m256i>(const uint64_t* p) noexcept { return vload_256(p); }
+#endif
+
+/**
+ * @brief Spreads the 4 little-endian words of a block over the even and odd bytes of two 64-bit words.
+ */
+static inline void interleave_in(uint64_t* q0, uint64_t* q1, const uint32_t* w) noexcept
+{
+    uint64_t x0 = w[0], x1 = w[1], x2 = w[2], x3 = w[3];
+    x0 |= (x0 << 16);
+    x1 |= (x1 << 16);
+    x2 |= (x2 << 16);
+    x3 |= (x3 << 16);
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    x0 |= (x0 << 8);
+    x1 |= (x1 << 8);
+    x2 |= (x2 << 8);
+    x3 |= (x3 << 8);
+    x0 &= 0x00FF00FF00FF00FFULL;
+    x1 &= 0x00FF00FF00FF00FFULL;
+    x2 &= 0x00FF00FF00FF00FFULL;
+    x3 &= 0x00FF00FF00FF00FFULL;
+    *q0 = x0 | (x2 << 8);
+    *q1 = x1 | (x3 << 8);
+}
+
+/**
+ * @brief Inverse of interleave_in().
+ */
+static inline void interleave_out(uint32_t* w, uint64_t q0, uint64_t q1) noexcept
+{
+    uint64_t x0 = q0 & 0x00FF00FF00FF00FFULL;
+    uint64_t x1 = q1 & 0x00FF00FF00FF00FFULL;
+    uint64_t x2 = (q0 >> 8) & 0x00FF00FF00FF00FFULL;
+    uint64_t x3 = (q1 >> 8) & 0x00FF00FF00FF00FFULL;
+    x0 |= (x0 >> 8);
+    x1 |= (x1 >> 8);
+    x2 |= (x2 >> 8);
+    x3 |= (x3 >> 8);
+    x0 &= 0x0000FFFF0000FFFFULL;
+    x1 &= 0x0000FFFF0000FFFFULL;
+    x2 &= 0x0000FFFF0000FFFFULL;
+    x3 &= 0x0000FFFF0000FFFFULL;
+    w[0] = static_cast<uint32_t>(x0) | static_cast<uint32_t>(x0 >> 16);
+    w[1] = static_cast<uint32_t>(x1) | static_cast<uint32_t>(x1 >> 16);
+    w[2] = static_cast<uint32_t>(x2) | static_cast<uint32_t>(x2 >> 16);
+    w[3] = static_cast<uint32_t>(x3) | static_cast<uint32_t>(x3 >> 16);
+}
+
+template <int S, typename V>
+static inline void swap_bits(V& x, V& y, uint64_t low_mask) noexcept
+{
+    const V cl = vbroadcast<V>(low_mask), ch = vbroadcast<V>(~low_mask);
+    const V a = x, b = y;
+    x = vor(vand(a, cl), vshl<S>(vand(b, cl)));
+    y = vor(vshr<S>(vand(a, ch)), vand(b, ch));
+}
+
+/**
+ * @brief Transposes the 8 words between the interleaved and the bitsliced representations (its own inverse).
+ */
+template <typename V>
+static inline void ortho(V* q) noexcept
+{
+    swap_bits<1>(q[0], q[1], 0x5555555555555555ULL);
+    swap_bits<1>(q[2], q[3], 0x5555555555555555ULL);
+    swap_bits<1>(q[4], q[5], 0x5555555555555555ULL);
+    swap_bits<1>(q[6], q[7], 0x5555555555555555ULL);
+
+    swap_bits<2>(q[0], q[2], 0x3333333333333333ULL);
+    swap_bits<2>(q[1], q[3], 0x3333333333333333ULL);
+    swap_bits<2>(q[4], q[6], 0x3333333333333333ULL);
+    swap_bits<2>(q[5], q[7], 0x3333333333333333ULL);
+
+    swap_bits<4>(q[0], q[4], 0x0F0F0F0F0F0F0F0FULL);
+    swap_bits<4>(q[1], q[5], 0x0F0F0F0F0F0F0F0FULL);
+    swap_bits<4>(q[2], q[6], 0x0F0F0F0F0F0F0F0FULL);
+    swap_bits<4>(q[3], q[7], 0x0F0F0F0F0F0F0F0FULL);
+}
+
+/**
+ * @brief Bitsliced AES S-box, Boyar-Peralta circuit of 113 gates.
+ */
+template <typename V>
+static inline void sbox(V* q) noexcept
+{
+    const V x0 = q[7], x1 = q[6], x2 = q[5], x3 = q[4], x4 = q[3], x5 = q[2], x6 = q[1], x7 = q[0];
+
+    // top linear transformation
+    const V y14 = vxor(x3, x5);
+    const V y13 = vxor(x0, x6);
+    const V y9 = vxor(x0, x3);
+    const V y8 = vxor(x0, x5);
+    const V t0 = vxor(x1, x2);
+    const V y1 = vxor(t0, x7);
+    const V y4 = vxor(y1, x3);
+    const V y12 = vxor(y13, y14);
+    const V y2 = vxor(y1, x0);
+    const V y5 = vxor(y1, x6);
+    const V y3 = vxor(y5, y8);
+    const V t1 = vxor(x4, y12);
+    const V y15 = vxor(t1, x5);
+    const V y20 = vxor(t1, x1);
+    const V y6 = vxor(y15, x7);
+    const V y10 = vxor(y15, t0);
+    const V y11 = vxor(y20, y9);
+    const V y7 = vxor(x7, y11);
+    const V y17 = vxor(y10, y11);
+    const V y19 = vxor(y10, y8);
+    const V y16 = vxor(t0, y11);
+    const V y21 = vxor(y13, y16);
+    const V y18 = vxor(x0, y16);
+
+    // non-linear section
+    const V t2 = vand(y12, y15);
+    const V t3 = vand(y3, y6);
+    const V t4 = vxor(t3, t2);
+    const V t5 = vand(y4, x7);
+    const V t6 = vxor(t5, t2);
+    const V t7 = vand(y13, y16);
+    const V t8 = vand(y5, y1);
+    const V t9 = vxor(t8, t7);
+    const V t10 = vand(y2, y7);
+    const V t11 = vxor(t10, t7);
+    const V t12 = vand(y9, y11);
+    const V t13 = vand(y14, y17);
+    const V t14 = vxor(t13, t12);
+    const V t15 = vand(y8, y10);
+    const V t16 = vxor(t15, t12);
+    const V t17 = vxor(t4, t14);
+    const V t18 = vxor(t6, t16);
+    const V t19 = vxor(t9, t14);
+    const V t20 = vxor(t11, t16);
+    const V t21 = vxor(t17, y20);
+    const V t22 = vxor(t18, y19);
+    const V t23 = vxor(t19, y21);
+    const V t24 = vxor(t20, y18);
+
+    const V t25 = vxor(t21, t22);
+    const V t26 = vand(t21, t23);
+    const V t27 = vxor(t24, t26);
+    const V t28 = vand(t25, t27);
+    const V t29 = vxor(t28, t22);
+    const V t30 = vxor(t23, t24);
+    const V t31 = vxor(t22, t26);
+    const V t32 = vand(t31, t30);
+    const V t33 = vxor(t32, t24);
+    const V t34 = vxor(t23, t33);
+    const V t35 = vxor(t27, t33);
+    const V t36 = vand(t24, t35);
+    const V t37 = vxor(t36, t34);
+    const V t38 = vxor(t27, t36);
+    const V t39 = vand(t29, t38);
+    const V t40 = vxor(t25, t39);
+
+    const V t41 = vxor(t40, t37);
+    const V t42 = vxor(t29, t33);
+    const V t43 = vxor(t29, t40);
+    const V t44 = vxor(t33, t37);
+    const V t45 = vxor(t42, t41);
+    const V z0 = vand(t44, y15);
+    const V z1 = vand(t37, y6);
+    const V z2 = vand(t33, x7);
+    const V z3 = vand(t43, y16);
+    const V z4 = vand(t40, y1);
+    const V z5 = vand(t29, y7);
+    const V z6 = vand(t42, y11);
+    const V z7 = vand(t45, y17);
+    const V z8 = vand(t41, y10);
+    const V z9 = vand(t44, y12);
+    const V z10 = vand(t37, y3);
+    const V z11 = vand(t33, y4);
+    const V z12 = vand(t43, y13);
+    const V z13 = vand(t40, y5);
+    const V z14 = vand(t29, y2);
+    const V z15 = vand(t42, y9);
+    const V z16 = vand(t45, y14);
+    const V z17 = vand(t41, y8);
+
+    // bottom linear transformation
+    const V t46 = vxor(z15, z16);
+    const V t47 = vxor(z10, z11);
+    const V t48 = vxor(z5, z13);
+    const V t49 = vxor(z9, z10);
+    const V t50 = vxor(z2, z12);
+    const V t51 = vxor(z2, z5);
+    const V t52 = vxor(z7, z8);
+    const V t53 = vxor(z0, z3);
+    const V t54 = vxor(z6, z7);
+    const V t55 = vxor(z16, z17);
+    const V t56 = vxor(z12, t48);
+    const V t57 = vxor(t50, t53);
+    const V t58 = vxor(z4, t46);
+    const V t59 = vxor(z3, t54);
+    const V t60 = vxor(t46, t57);
+    const V t61 = vxor(z14, t57);
+    const V t62 = vxor(t52, t58);
+    const V t63 = vxor(t49, t58);
+    const V t64 = vxor(z4, t59);
+    const V t65 = vxor(t61, t62);
+    const V t66 = vxor(z1, t63);
+    const V s0 = vxor(t59, t63);
+    const V s6 = vxor(t56, vnot(t62));
+    const V s7 = vxor(t48, vnot(t60));
+    const V t67 = vxor(t64, t65);
+    const V s3 = vxor(t53, t66);
+    const V s4 = vxor(t51, t66);
+    const V s5 = vxor(t47, t65);
+    const V s1 = vxor(t64, vnot(s3));
+    const V s2 = vxor(t55, vnot(t67));
+
+    q[7] = s0;
+    q[6] = s1;
+    q[5] = s2;
+    q[4] = s3;
+    q[3] = s4;
+    q[2] = s5;
+    q[1] = s6;
+    q[0] = s7;
+}
+
+/**
+ * @brief Inverse of the affine transformation of the S-box, so that inv_sbox = affine^-1 o sbox o affine^-1.
+ */
+template <typename V>
+static inline void inv_affine(V* q) noexcept
+{
+    const V q0 = vnot(q[0]), q1 = vnot(q[1]), q2 = q[2], q3 = q[3], q4 = q[4], q5 = vnot(q[5]), q6 = vnot(q[6]), q7 = q[7];
+    q[7] = vxor(vxor(q1, q4), q6);
+    q[6] = vxor(vxor(q0, q3), q5);
+    q[5] = vxor(vxor(q7, q2), q4);
+    q[4] = vxor(vxor(q6, q1), q3);
+    q[3] = vxor(vxor(q5, q0), q2);
+    q[2] = vxor(vxor(q4, q7), q1);
+    q[1] = vxor(vxor(q3, q6), q0);
+    q[0] = vxor(vxor(q2, q5), q7);
+}
+
+template <typename V>
+static inline void inv_sbox(V* q) noexcept
+{
+    inv_affine(q);
+    sbox(q);
+    inv_affine(q);
+}
+
+template <typename V>
+static inline void add_round_key(V* q, const V* round_key) noexcept
+{
+    for (int i = 0; i < 8; ++i)
+        q[i] = vxor(q[i], round_key[i]);
+}
+
+template <uint64_t MASK, int S, typename V>
+static inline V move_bits(V x) noexcept
+{
+    const V m = vand(x, vbroadcast<V>(MASK));
+    return S > 0 ? vshl<(S > 0 ? S : 0)>(m) : vshr<(S < 0 ? -S : 0)>(m);
+}
+
+template <typename V>
+static inline void shift_rows(V* q) noexcept
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        const V x = q[i];
+        q[i] = vor(vor(vor(move_bits<0x000000000000FFFFULL, 0>(x), move_bits<0x00000000FFF00000ULL, -4>(x)),
+                       vor(move_bits<0x00000000000F0000ULL, 12>(x), move_bits<0x0000FF0000000000ULL, -8>(x))),
+                   vor(vor(move_bits<0x000000FF00000000ULL, 8>(x), move_bits<0xF000000000000000ULL, -12>(x)),
+                       move_bits<0x0FFF000000000000ULL, 4>(x)));
+    }
+}
+
+template <typename V>
+static inline void inv_shift_rows(V* q) noexcept
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        const V x = q[i];
+        q[i] = vor(vor(vor(move_bits<0x000000000000FFFFULL, 0>(x), move_bits<0x000000000FFF0000ULL, 4>(x)),
+                       vor(move_bits<0x00000000F0000000ULL, -12>(x), move_bits<0x000000FF00000000ULL, 8>(x))),
+                   vor(vor(move_bits<0x0000FF0000000000ULL, -8>(x), move_bits<0x000F000000000000ULL, 12>(x)),
+                       move_bits<0xFFF0000000000000ULL, -4>(x)));
+    }
+}
+
+template <typename V>
+static inline V rotr16(V x) noexcept
+{
+    return vor(vshr<16>(x), vshl<48>(x));
+}
+
+template <typename V>
+static inline void mix_columns(V* q) noexcept
+{
+    const V q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3], q4 = q[4], q5 = q[5], q6 = q[6], q7 = q[7];
+    const V r0 = rotr16(q0), r1 = rotr16(q1), r2 = rotr16(q2), r3 = rotr16(q3);
+    const V r4 = rotr16(q4), r5 = rotr16(q5), r6 = rotr16(q6), r7 = rotr16(q7);
+    const V q7r7 = vxor(q7, r7);
+
+    q[0] = vxor(vxor(q7r7, r0), vrotr32(vxor(q0, r0)));
+    q[1] = vxor(vxor(vxor(q0, r0), vxor(q7r7, r1)), vrotr32(vxor(q1, r1)));
+    q[2] = vxor(vxor(vxor(q1, r1), r2), vrotr32(vxor(q2, r2)));
+    q[3] = vxor(vxor(vxor(q2, r2), vxor(q7r7, r3)), vrotr32(vxor(q3, r3)));
+    q[4] = vxor(vxor(vxor(q3, r3), vxor(q7r7, r4)), vrotr32(vxor(q4, r4)));
+    q[5] = vxor(vxor(vxor(q4, r4), r5), vrotr32(vxor(q5, r5)));
+    q[6] = vxor(vxor(vxor(q5, r5), r6), vrotr32(vxor(q6, r6)));
+    q[7] = vxor(vxor(vxor(q6, r6), r7), vrotr32(q7r7));
+}
+
+/**
+ * @brief InvMixColumns, computed as MixColumns o M with M(x) = x ^ 4.(x ^ (x rotated by two rows)).
+ */
+template <typename V>
+static inline void inv_mix_columns(V* q) noexcept
+{
+    // u = x ^ rot2(x), rotating a column by two rows being a 32-bit rotation in this representation
+    V u[8];
+    for (int i = 0; i < 8; ++i)
+        u[i] = vxor(q[i], vrotr32(q[i]));
+
+    // x ^= 4.u in GF(2^8), with bit slice i holding bit i of every byte
+    const V c6 = u[6], c7 = u[7];
+    V m[8];
+    m[0] = vxor(q[0], c6);
+    m[1] = vxor(q[1], vxor(c6, c7));
+    m[2] = vxor(q[2], vxor(u[0], c7));
+    m[3] = vxor(q[3], vxor(u[1], c6));
+    m[4] = vxor(q[4], vxor(u[2], vxor(c6, c7)));
+    m[5] = vxor(q[5], vxor(u[3], c7));
+    m[6] = vxor(q[6], u[4]);
+    m[7] = vxor(q[7], u[5]);
+
+    for (int i = 0; i < 8; ++i)
+        q[i] = m[i];
+    mix_columns(q);
+}
+
+template <typename V>
+static inline void encrypt_slices(V* q, const V* round_keys) noexcept
+{
+    add_round_key(q, round_keys);
+    for (int round = 1; round < 10; ++round)
+    {
+        sbox(q);
+        shift_rows(q);
+        mix_columns(q);
+        add_round_key(q, round_keys + 8 * round);
+    }
+    sbox(q);
+    shift_rows(q);
+    add_round_key(q, round_keys + 80);
+}
+
+template <typename V>
+static inline void decrypt_slices(V* q, const V* round_keys) noexcept
+{
+    add_round_key(q, round_keys + 80);
+    for (int round = 9; round > 0; --round)
+    {
+        inv_shift_rows(q);
+        inv_sbox(q);
+        add_round_key(q, round_keys + 8 * round);
+        inv_mix_columns(q);
+    }
+    inv_shift_rows(q);
+    inv_sbox(q);
+    add_round_key(q, round_keys);
+}
+
+/**
+ * @brief Encrypts or decrypts any number of blocks, 4 * L blocks per pass.
+ *
+ * @param round_keys The 11 * 8 bitsliced round key words.
+ */
+template <typename V>
+static void process_blocks(const uint64_t* round_keys, const uint8_t* src, uint8_t* dest, std::size_t blocks, bool decrypt) noexcept
+{
+    const std::size_t lanes = sizeof(V) / sizeof(uint64_t);
+    const std::size_t per_pass = 4 * lanes;
+
+    V keys[88];
+    for (int i = 0; i < 88; ++i)
+        keys[i] = vbroadcast<V>(round_keys[i]);
+
+    for (std::size_t done = 0; done < blocks; done += per_pass)
+    {
+        const std::size_t n = blocks - done < per_pass ? blocks - done : per_pass;
+        uint32_t words[4 * 16] = {0};
+        std::memcpy(words, src + 16 * done, 16 * n);
+
+        // slice k of lane l gathers the blocks 4l .. 4l + 3
+        uint64_t slices[8][4];
+        for (std::size_t l = 0; l < lanes; ++l)
+            for (int i = 0; i < 4; ++i)
+                interleave_in(&slices[i][l], &slices[i + 4][l], words + 4 * (4 * l + i));
+
+        V q[8];
+        for (int i = 0; i < 8; ++i)
+            q[i] = vloadu<V>(slices[i]);
+
+        ortho(q);
+        if (decrypt)
+            decrypt_slices(q, keys);
+        else
+            encrypt_slices(q, keys);
+        ortho(q);
+
+        for (int i = 0; i < 8; ++i)
+            vstore(slices[i], q[i]);
+        for (std::size_t l = 0; l < lanes; ++l)
+            for (int i = 0; i < 4; ++i)
+                interleave_out(words + 4 * (4 * l + i), slices[i][l], slices[i + 4][l]);
+
+        std::memcpy(dest + 16 * done, words, 16 * n);
+    }
+}
+
+void bitsliced_process_avx2(const uint64_t* round_keys, const uint8_t* src, uint8_t* dest, std::size_t blocks, bool decrypt) noexcept;
+
+#endif // __BITSLICED_KERNEL_H_INCLUDED__
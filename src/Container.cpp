@@ -0,0 +1,436 @@
+#include <new>
+#include <random>
+#include <cstring>
+#include <algorithm>
+
+#include "../include/FdIO.hpp"
+#include "../include/Container.hpp"
+
+using Container::STATUS;
+
+static const char HEADER_MAGIC[8] = {'S', 'M', 'A', 'E', 'S', 'C', 'T', '1'};
+static const char FOOTER_MAGIC[8] = {'S', 'M', 'A', 'E', 'S', 'I', 'X', '1'};
+static const uint32_t MAX_CHUNK_SIZE = 1024 * 1024 * 1024;
+
+static void store_le32(uint8_t* p, uint32_t v) noexcept
+{
+    for (int i = 0; i < 4; ++i)
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static void store_le64(uint8_t* p, uint64_t v) noexcept
+{
+    for (int i = 0; i < 8; ++i)
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+static uint32_t load_le32(const uint8_t* p) noexcept
+{
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static uint64_t load_le64(const uint8_t* p) noexcept
+{
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static std::size_t entry_size(bool tagged) noexcept
+{
+    return 32 + (tagged ? 16 : 0);
+}
+
+/**
+ * @brief Fills the 16-byte IV of a chunk, nonce | be32(chunk) | be32(0).
+ */
+static void chunk_iv(const uint8_t* nonce, uint32_t chunk, uint8_t* iv) noexcept
+{
+    std::memcpy(iv, nonce, 8);
+    for (int i = 0; i < 4; ++i)
+    {
+        iv[8 + i] = static_cast<uint8_t>(chunk >> (24 - 8 * i));
+        iv[12 + i] = 0;
+    }
+}
+
+/**
+ * @brief Computes the index tag, the AES-CMAC of header | index | footer.
+ */
+static void index_tag(FastAES& mac_aes, const uint8_t* header, const uint8_t* table, std::size_t table_size, const uint8_t* footer, uint8_t* tag)
+{
+    std::vector<uint8_t> msg(Container::HEADER_SIZE + table_size + Container::FOOTER_SIZE);
+    std::memcpy(msg.data(), header, Container::HEADER_SIZE);
+    std::memcpy(msg.data() + Container::HEADER_SIZE, table, table_size);
+    std::memcpy(msg.data() + Container::HEADER_SIZE + table_size, footer, Container::FOOTER_SIZE);
+    mac_aes.cmac(msg.data(), msg.size(), tag);
+}
+
+/**
+ * @brief Derives the FastAES instance used for chunk tags, keyed with E(K, label) so that
+ * the CTR encryption and the CMAC never share a key.
+ */
+static std::unique_ptr<FastAES> derive_mac_aes(FastAES& aes)
+{
+    alignas(16) uint8_t label[16] = {'S', 'M', '-', 'A', 'E', 'S', ' ', 'C', 'M', 'A', 'C', ' ', 'K', 'E', 'Y', 0};
+    alignas(16) uint8_t mac_key[16];
+    aes.encrypt(label, mac_key, 16, 1);
+    return std::unique_ptr<FastAES>(new FastAES(mac_key));
+}
+
+/**
+ * @brief Constructs a container writer.
+ *
+ * @param aes The FastAES instance holding the container key.
+ * @param fd File descriptor the container is written to, only appended to.
+ * @param chunk_size Plaintext size of each chunk, rounded down to a multiple of 16.
+ * @param tagged Whether to store an AES-CMAC tag for every chunk.
+ * @param num_threads Number of threads used to encrypt each chunk.
+ */
+ContainerWriter::ContainerWriter(FastAES& aes, int fd, uint32_t chunk_size, bool tagged, uint32_t num_threads)
+    : aes(aes), fd(fd), chunk_size(std::min(std::max<uint32_t>(chunk_size, 16), MAX_CHUNK_SIZE) & ~uint32_t(15)), tagged(tagged),
+      num_threads(num_threads == 0 ? 1 : num_threads)
+{
+}
+
+/**
+ * @brief Draws the container nonce, allocates the chunk buffer and writes the header.
+ */
+STATUS ContainerWriter::start() noexcept
+{
+    started = true;
+
+    std::random_device rd;
+    for (std::size_t i = 0; i < nonce.size(); i += 4)
+        store_le32(nonce.data() + i, rd());
+
+    // the chunk IV is kept right before the data so that the tag covers iv | ciphertext in one pass
+    buffer.reset(new(std::nothrow) uint8_t[16 + chunk_size]);
+    if (buffer == nullptr)
+        return STATUS::ALLOC_ERROR;
+
+    if (tagged)
+        mac_aes = derive_mac_aes(aes);
+
+    std::memset(header, 0, sizeof(header));
+    std::memcpy(header, HEADER_MAGIC, 8);
+    store_le32(header + 8, Container::VERSION);
+    store_le32(header + 12, tagged ? Container::FLAG_TAGGED : 0);
+    store_le32(header + 16, chunk_size);
+    std::memcpy(header + 24, nonce.data(), nonce.size());
+    if (not write_full(fd, header, sizeof(header)))
+        return STATUS::WRITE_ERROR;
+
+    offset = Container::HEADER_SIZE;
+    return STATUS::OK;
+}
+
+/**
+ * @brief Encrypts the buffered chunk, writes it out and records its index entry.
+ */
+STATUS ContainerWriter::flush_chunk() noexcept
+{
+    if (index.size() > UINT32_MAX)
+        return STATUS::BAD_RANGE;
+
+    Container::Entry entry;
+    chunk_iv(nonce.data(), static_cast<uint32_t>(index.size()), entry.iv.data());
+    entry.offset = offset;
+    entry.length = static_cast<uint32_t>(buffered);
+
+    uint8_t* data = buffer.get() + 16;
+    aes.ctr_crypt(data, data, buffered, entry.iv.data(), 0, num_threads);
+    if (tagged)
+    {
+        std::memcpy(buffer.get(), entry.iv.data(), 16);
+        mac_aes->cmac(buffer.get(), 16 + buffered, entry.tag.data());
+    }
+    else
+        entry.tag.fill(0);
+
+    if (not write_full(fd, data, buffered))
+        return STATUS::WRITE_ERROR;
+
+    index.push_back(entry);
+    offset += buffered;
+    buffered = 0;
+    return STATUS::OK;
+}
+
+/**
+ * @brief Appends plaintext to the container, writing out every chunk as soon as it is full.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+STATUS ContainerWriter::write(const uint8_t* data, std::size_t length) noexcept
+{
+    if (not started)
+    {
+        STATUS status = start();
+        if (status != STATUS::OK)
+            return status;
+    }
+
+    while (length != 0)
+    {
+        std::size_t n = std::min<std::size_t>(length, chunk_size - buffered);
+        std::memcpy(buffer.get() + 16 + buffered, data, n);
+        buffered += n;
+        plaintext_size += n;
+        data += n;
+        length -= n;
+
+        if (buffered == chunk_size)
+        {
+            STATUS status = flush_chunk();
+            if (status != STATUS::OK)
+                return status;
+        }
+    }
+
+    return STATUS::OK;
+}
+
+/**
+ * @brief Writes out the last partial chunk, the index, the index tag of a tagged container and the footer.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+STATUS ContainerWriter::finish() noexcept
+{
+    STATUS status = started ? STATUS::OK : start();
+    if (status == STATUS::OK and buffered != 0)
+        status = flush_chunk();
+    if (status != STATUS::OK)
+        return status;
+
+    const std::size_t esize = entry_size(tagged);
+    const std::size_t index_size = index.size() * esize;
+    const std::size_t tag_size = tagged ? Container::TAG_SIZE : 0;
+    std::vector<uint8_t> table(index_size + tag_size + Container::FOOTER_SIZE, 0);
+    uint8_t* p = table.data();
+    for (const auto& entry : index)
+    {
+        std::memcpy(p, entry.iv.data(), 16);
+        store_le64(p + 16, entry.offset);
+        store_le32(p + 24, entry.length);
+        if (tagged)
+            std::memcpy(p + 32, entry.tag.data(), 16);
+        p += esize;
+    }
+
+    uint8_t* footer = p + tag_size;
+    store_le64(footer, offset);
+    store_le64(footer + 8, index.size());
+    store_le64(footer + 16, plaintext_size);
+    std::memcpy(footer + 24, FOOTER_MAGIC, 8);
+    if (tagged)
+        index_tag(*mac_aes, header, table.data(), index_size, footer, p);
+
+    return write_full(fd, table.data(), table.size()) ? STATUS::OK : STATUS::WRITE_ERROR;
+}
+
+/**
+ * @brief Constructs a container reader, open() must be called before reading.
+ *
+ * @param aes The FastAES instance holding the container key.
+ * @param fd Seekable file descriptor of the container.
+ * @param num_threads Number of threads used to decrypt chunks in parallel.
+ */
+ContainerReader::ContainerReader(FastAES& aes, int fd, uint32_t num_threads)
+    : aes(aes), fd(fd), num_threads(num_threads == 0 ? 1 : num_threads)
+{
+}
+
+/**
+ * @brief Reads and validates the header, the footer and the chunk index, and authenticates them when tagged.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+STATUS ContainerReader::open() noexcept
+{
+    long long fsize = file_size(fd);
+    if (fsize < 0)
+        return STATUS::READ_ERROR;
+    if (static_cast<uint64_t>(fsize) < Container::HEADER_SIZE + Container::FOOTER_SIZE)
+        return STATUS::BAD_FORMAT;
+
+    uint8_t header[Container::HEADER_SIZE], footer[Container::FOOTER_SIZE];
+    if (pread_full(fd, header, sizeof(header), 0) != sizeof(header) or pread_full(fd, footer, sizeof(footer), fsize - sizeof(footer)) != sizeof(footer))
+        return STATUS::READ_ERROR;
+
+    const uint32_t flags = load_le32(header + 12);
+    chunk_size = load_le32(header + 16);
+    tagged = (flags & Container::FLAG_TAGGED) != 0;
+    if (std::memcmp(header, HEADER_MAGIC, 8) or load_le32(header + 8) != Container::VERSION or (flags & ~Container::FLAG_TAGGED)
+        or chunk_size == 0 or chunk_size % 16 != 0 or chunk_size > MAX_CHUNK_SIZE or std::memcmp(footer + 24, FOOTER_MAGIC, 8))
+        return STATUS::BAD_FORMAT;
+
+    const uint64_t index_offset = load_le64(footer);
+    const uint64_t count = load_le64(footer + 8);
+    plaintext_size = load_le64(footer + 16);
+    const std::size_t esize = entry_size(tagged);
+    const std::size_t tag_size = tagged ? Container::TAG_SIZE : 0;
+    const uint64_t table_end = fsize - Container::FOOTER_SIZE;
+    if (index_offset < Container::HEADER_SIZE or index_offset > table_end or table_end - index_offset < tag_size
+        or count != (table_end - index_offset - tag_size) / esize or count * esize != table_end - index_offset - tag_size
+        or count > UINT32_MAX + uint64_t(1))
+        return STATUS::BAD_FORMAT;
+
+    std::vector<uint8_t> table;
+    try { table.resize(count * esize + tag_size); }
+    catch (const std::bad_alloc&) { return STATUS::ALLOC_ERROR; }
+    if (pread_full(fd, table.data(), table.size(), index_offset) != static_cast<long long>(table.size()))
+        return STATUS::READ_ERROR;
+
+    // authenticate the layout first, so that nothing below relies on forged values
+    if (tagged)
+    {
+        mac_aes = derive_mac_aes(aes);
+        uint8_t tag[Container::TAG_SIZE];
+        try { index_tag(*mac_aes, header, table.data(), count * esize, footer, tag); }
+        catch (const std::bad_alloc&) { return STATUS::ALLOC_ERROR; }
+
+        const uint8_t* expected = table.data() + count * esize;
+        uint8_t diff = 0;
+        for (std::size_t i = 0; i < Container::TAG_SIZE; ++i)
+            diff |= tag[i] ^ expected[i];
+        if (diff != 0)
+            return STATUS::BAD_TAG;
+    }
+
+    index.clear();
+    index.reserve(count);
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < count; ++i)
+    {
+        const uint8_t* p = table.data() + i * esize;
+        Container::Entry entry;
+        std::memcpy(entry.iv.data(), p, 16);
+        entry.offset = load_le64(p + 16);
+        entry.length = load_le32(p + 24);
+        if (tagged)
+            std::memcpy(entry.tag.data(), p + 32, 16);
+        else
+            entry.tag.fill(0);
+
+        // the IV is bound to the chunk position, every chunk but the last one is full, and all of them lie between the header and the index
+        std::array<uint8_t, 16> iv;
+        chunk_iv(header + 24, static_cast<uint32_t>(i), iv.data());
+        if (entry.iv != iv or entry.length == 0 or entry.length > chunk_size or (i + 1 != count and entry.length != chunk_size)
+            or entry.offset < Container::HEADER_SIZE or entry.offset > index_offset or entry.length > index_offset - entry.offset)
+            return STATUS::BAD_FORMAT;
+
+        total += entry.length;
+        index.push_back(entry);
+    }
+
+    if (total != plaintext_size)
+        return STATUS::BAD_FORMAT;
+
+    return STATUS::OK;
+}
+
+/**
+ * @brief Decrypts the bytes [begin, end) of a chunk into dest.
+ *
+ * Only the blocks covering the range are read, unless the chunk is tagged in which case the whole
+ * chunk has to be read to be authenticated first.
+ *
+ * @param buffer Scratch buffer of at least 16 + chunk_size bytes.
+ * @param threads Number of threads used to decrypt the chunk itself.
+ */
+STATUS ContainerReader::read_chunk(std::size_t chunk, uint64_t begin, uint64_t end, uint8_t* dest, uint8_t* buffer, uint32_t threads) noexcept
+{
+    const Container::Entry& entry = index[chunk];
+    const uint64_t block_begin = begin & ~uint64_t(15);
+    const uint64_t read_begin = tagged ? 0 : block_begin;
+    const uint64_t read_end = tagged ? entry.length : end;
+    uint8_t* data = buffer + 16;
+
+    const long long n = pread_full(fd, data + read_begin, read_end - read_begin, entry.offset + read_begin);
+    if (n != static_cast<long long>(read_end - read_begin))
+        return STATUS::READ_ERROR;
+
+    if (tagged)
+    {
+        std::memcpy(buffer, entry.iv.data(), 16);
+        uint8_t tag[16];
+        mac_aes->cmac(buffer, 16 + entry.length, tag);
+
+        uint8_t diff = 0;
+        for (int i = 0; i < 16; ++i)
+            diff |= tag[i] ^ entry.tag[i];
+        if (diff != 0)
+            return STATUS::BAD_TAG;
+    }
+
+    // a range starting inside a block is decrypted in place, an aligned one straight into dest
+    if (begin != block_begin)
+    {
+        aes.ctr_crypt(data + block_begin, data + block_begin, end - block_begin, entry.iv.data(), block_begin / 16, threads);
+        std::memcpy(dest, data + begin, end - begin);
+    }
+    else
+        aes.ctr_crypt(data + begin, dest, end - begin, entry.iv.data(), begin / 16, threads);
+
+    return STATUS::OK;
+}
+
+/**
+ * @brief Decrypts an arbitrary plaintext byte range, reading and decrypting the chunks it covers in parallel.
+ *
+ * @param offset Offset of the first plaintext byte to decrypt.
+ * @param dest Pointer to the output buffer, of at least length bytes.
+ * @param length Number of bytes to decrypt.
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+STATUS ContainerReader::read(uint64_t offset, uint8_t* dest, std::size_t length) noexcept
+{
+    if (offset > plaintext_size or length > plaintext_size - offset)
+        return STATUS::BAD_RANGE;
+    if (length == 0)
+        return STATUS::OK;
+
+    const std::size_t first = offset / chunk_size;
+    const std::size_t last = (offset + length - 1) / chunk_size;
+    const std::size_t count = last - first + 1;
+    const uint32_t workers = static_cast<uint32_t>(std::min<std::size_t>(count, num_threads));
+
+    std::atomic<int> status(static_cast<int>(STATUS::OK));
+    auto thread_func = [&](uint32_t worker)
+    {
+        std::unique_ptr<uint8_t[]> buffer(new(std::nothrow) uint8_t[16 + chunk_size]);
+        if (buffer == nullptr)
+        {
+            status = static_cast<int>(STATUS::ALLOC_ERROR);
+            return;
+        }
+
+        for (std::size_t chunk = first + worker; chunk <= last and status == static_cast<int>(STATUS::OK); chunk += workers)
+        {
+            const uint64_t chunk_begin = static_cast<uint64_t>(chunk) * chunk_size;
+            const uint64_t begin = std::max(offset, chunk_begin) - chunk_begin;
+            const uint64_t end = std::min<uint64_t>(offset + length, chunk_begin + index[chunk].length) - chunk_begin;
+
+            STATUS result = read_chunk(chunk, begin, end, dest + (chunk_begin + begin - offset), buffer.get(), count == 1 ? num_threads : 1);
+            if (result != STATUS::OK)
+                status = static_cast<int>(result);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (uint32_t i = 1; i < workers; ++i)
+        threads.emplace_back(thread_func, i);
+    thread_func(0);
+
+    for (auto &thread : threads)
+        if (thread.joinable())
+            thread.join();
+
+    return static_cast<STATUS>(status.load());
+}
@@ -1,9 +1,42 @@
+#include <cstring>
 #include <iostream>
 #include <wmmintrin.h>
 #include <emmintrin.h>
 
 #include "../include/FastAES.hpp"
 
+/**
+ * @brief Encrypts a single block with an expanded encryption key schedule.
+ */
+static inline __m128i encrypt_block(__m128i block, const __m128i* key_schedule) noexcept
+{
+    block = _mm_xor_si128(block, key_schedule[0]);
+    for (int j = 1; j < 10; ++j)
+        block = _mm_aesenc_si128(block, key_schedule[j]);
+    return _mm_aesenclast_si128(block, key_schedule[10]);
+}
+
+/**
+ * @brief Builds the big-endian 128-bit counter block (hi:lo) + add.
+ */
+static inline __m128i counter_block(uint64_t hi, uint64_t lo, uint64_t add) noexcept
+{
+    uint64_t sum = lo + add;
+    hi += (sum < lo);
+    return _mm_set_epi64x(static_cast<long long>(__builtin_bswap64(sum)), static_cast<long long>(__builtin_bswap64(hi)));
+}
+
+/**
+ * @brief Doubles a 128-bit value in GF(2^128), as required to derive the CMAC subkeys.
+ */
+static void cmac_double(const uint8_t* in, uint8_t* out) noexcept
+{
+    const uint8_t carry = in[0] >> 7;
+    for (int i = 0; i < 15; ++i)
+        out[i] = static_cast<uint8_t>((in[i] << 1) | (in[i + 1] >> 7));
+    out[15] = static_cast<uint8_t>((in[15] << 1) ^ (carry ? 0x87 : 0x00));
+}
+
 /**
  * @brief Checks if the CPU supports AES hardware acceleration instructions.
  * 
@@ -21,20 +54,150 @@ inline bool FastAES::supports_aes() const noexcept
     return (arr[2] & (1<<25)) != 0;
 }
 
+/**
+ * @brief Returns the number of CMAC blocks of a message, the empty message counting as one block.
+ */
+static inline std::size_t cmac_blocks(std::size_t length) noexcept
+{
+    return length == 0 ? 1 : (length + 15) / 16;
+}
+
+/**
+ * @brief Builds the last CMAC block of a message, padded if incomplete and xored with the matching subkey.
+ */
+static inline __m128i cmac_last_block(const uint8_t* msg, std::size_t length, const uint8_t* subkeys) noexcept
+{
+    const std::size_t blocks = cmac_blocks(length);
+    const bool complete = length != 0 and length % 16 == 0;
+
+    alignas(16) uint8_t last[16] = {0};
+    const std::size_t last_length = length - 16*(blocks - 1);
+    if (last_length != 0)
+        std::memcpy(last, msg + 16*(blocks - 1), last_length);
+    if (not complete)
+        last[last_length] = 0x80;
+
+    __m128i subkey = _mm_load_si128(reinterpret_cast<const __m128i*>(subkeys + (complete ? 0 : 16)));
+    return _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(last)), subkey);
+}
+
+/**
+ * @brief CMAC of the messages [first, last), LANES chains being advanced in lockstep one block per pass.
+ * 
+ * A lane is refilled with the next message as soon as its chain ends, so that messages of mixed lengths
+ * keep every lane busy. Idle lanes at the end of the batch just encrypt garbage that is never stored.
+ */
+template <std::size_t LANES>
+static void cmac_lanes(const uint8_t* const* msgs, const std::size_t* lengths, std::size_t first, std::size_t last, uint8_t* tags,
+                       const __m128i* key_schedule, const BitslicedAES* bitsliced, const uint8_t* subkeys) noexcept
+{
+    __m128i state[LANES], final_block[LANES];
+    const uint8_t* cursor[LANES];
+    std::size_t remaining[LANES], msg[LANES];
+    bool active[LANES];
+
+    std::size_t next = first, running = 0;
+    auto refill = [&](std::size_t k)
+    {
+        active[k] = next < last;
+        state[k] = _mm_setzero_si128();
+        remaining[k] = 0;
+        final_block[k] = _mm_setzero_si128();
+        if (not active[k])
+            return;
+
+        msg[k] = next++;
+        cursor[k] = msgs[msg[k]];
+        remaining[k] = cmac_blocks(lengths[msg[k]]) - 1;
+        final_block[k] = cmac_last_block(msgs[msg[k]], lengths[msg[k]], subkeys);
+        ++running;
+    };
+
+    for (std::size_t k = 0; k < LANES; ++k)
+        refill(k);
+
+    alignas(16) uint8_t stage[16 * LANES];
+    while (running != 0)
+    {
+        for (std::size_t k = 0; k < LANES; ++k)
+        {
+            if (remaining[k] != 0)
+            {
+                state[k] = _mm_xor_si128(state[k], _mm_loadu_si128(reinterpret_cast<const __m128i*>(cursor[k])));
+                cursor[k] += 16;
+            }
+            else
+                state[k] = _mm_xor_si128(state[k], final_block[k]);
+        }
+
+        if (bitsliced != nullptr)
+        {
+            for (std::size_t k = 0; k < LANES; ++k)
+                _mm_store_si128(reinterpret_cast<__m128i*>(stage + 16*k), state[k]);
+            bitsliced->encrypt_blocks(stage, stage, LANES);
+            for (std::size_t k = 0; k < LANES; ++k)
+                state[k] = _mm_load_si128(reinterpret_cast<const __m128i*>(stage + 16*k));
+        }
+        else
+        {
+            for (std::size_t k = 0; k < LANES; ++k)
+                state[k] = _mm_xor_si128(state[k], key_schedule[0]);
+            for (int j = 1; j < 10; ++j)
+                for (std::size_t k = 0; k < LANES; ++k)
+                    state[k] = _mm_aesenc_si128(state[k], key_schedule[j]);
+            for (std::size_t k = 0; k < LANES; ++k)
+                state[k] = _mm_aesenclast_si128(state[k], key_schedule[10]);
+        }
+
+        for (std::size_t k = 0; k < LANES; ++k)
+        {
+            if (remaining[k] != 0)
+                --remaining[k];
+            else if (active[k])
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(tags + 16*msg[k]), state[k]);
+                --running;
+                refill(k);
+            }
+        }
+    }
+}
+
 /**
  * @brief Constructs a FastAES object and initializes key schedules for encryption and decryption.
  * 
  * @param key The encryption key as a 128-bit (16 bytes) array.
+ * @param engine The AES engine to use, the bitsliced one being picked automatically if AES-NI is unavailable.
  */
-FastAES::FastAES(const uint8_t* key) : key(key), enc_key_schedule(new uint8_t[176]), dec_key_schedule(new uint8_t[176])
+FastAES::FastAES(const uint8_t* key, ENGINE engine) : key(key), enc_key_schedule(new uint8_t[176]), dec_key_schedule(new uint8_t[176])
 {
-    if (not supports_aes())
+    if (engine == ENGINE::AESNI and not supports_aes())
+        std::cerr << "This cpu doesnt supports AES hardware acceleration instruction set, falling back to the bitsliced engine!\n";
+
+    alignas(16) uint8_t l[16] = {0};
+    if (engine == ENGINE::BITSLICED or not supports_aes())
     {
-        std::cerr << "This cpu doesnt supports AES hardware acceleration instruction set, aborting!\n";
-        return;
+        BitslicedAES::key_expansion(key, enc_key_schedule.get());
+        bitsliced.reset(new BitslicedAES(enc_key_schedule.get()));
+        bitsliced->encrypt_blocks(l, l, 1);
+    }
+    else
+    {
+        key_expansion(enc_key_schedule.get(), dec_key_schedule.get());
+        _mm_store_si128(reinterpret_cast<__m128i*>(l), encrypt_block(_mm_setzero_si128(), reinterpret_cast<const __m128i*>(enc_key_schedule.get())));
     }
 
-    key_expansion(enc_key_schedule.get(), dec_key_schedule.get());
+    // CMAC subkeys K1 and K2 derived from L = E(0)
+    cmac_double(l, cmac_subkeys);
+    cmac_double(cmac_subkeys, cmac_subkeys + 16);
+}
+
+/**
+ * @brief Returns the engine in use, either ENGINE::AESNI or ENGINE::BITSLICED.
+ */
+FastAES::ENGINE FastAES::get_engine() const noexcept
+{
+    return bitsliced ? ENGINE::BITSLICED : ENGINE::AESNI;
 }
 
 FastAES::~FastAES()
@@ -97,6 +260,12 @@ void FastAES::encrypt(const uint8_t* src, uint8_t* dest, std::size_t length, uin
     {
         auto thread_func = [&](const uint8_t* _src, uint8_t* _dest, int start, int end, const uint8_t* enc_key_schedule_ptr)
         {
+            if (bitsliced)
+            {
+                bitsliced->encrypt_blocks(_src + 16*start, _dest + 16*start, end - start);
+                return;
+            }
+
             for (int i = start; i < end; ++i)
             {
                 const __m128i* _enc_key_schedule_vector = reinterpret_cast<const __m128i*>(enc_key_schedule_ptr);
@@ -148,6 +317,12 @@ void FastAES::decrypt(const uint8_t* src, uint8_t* dest, std::size_t length, uin
     {
         auto thread_func = [&](const uint8_t* _src, uint8_t* _dest, int start, int end, const uint8_t* dec_key_schedule_ptr)
         {
+            if (bitsliced)
+            {
+                bitsliced->decrypt_blocks(_src + 16*start, _dest + 16*start, end - start);
+                return;
+            }
+
             for (int i = start; i < end; ++i)
             {
                 const __m128i* _dec_key_schedule_vector = reinterpret_cast<const __m128i*>(dec_key_schedule_ptr);
@@ -182,4 +357,243 @@ void FastAES::decrypt(const uint8_t* src, uint8_t* dest, std::size_t length, uin
             if (thread.joinable())
                 thread.join();
     }
+}
+
+/**
+ * @brief Encrypts or decrypts data using AES in CTR mode.
+ * 
+ * The keystream block i is the encryption of the big-endian 128-bit counter iv + counter_offset + i,
+ * so any block-aligned part of a CTR stream can be processed on its own. The length doesn't need to be
+ * a multiple of 16 and src may be equal to dest.
+ * 
+ * @param src Pointer to the input data.
+ * @param dest Pointer to the output buffer, of at least length bytes.
+ * @param length Length of the data in bytes.
+ * @param iv The 16 bytes initial counter block.
+ * @param counter_offset Index of the first block relative to iv.
+ * @param num_threads Number of threads to use.
+ */
+void FastAES::ctr_crypt(const uint8_t* src, uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset, uint32_t num_threads) noexcept
+{
+    ctr_process(src, dest, length, iv, counter_offset, num_threads);
+}
+
+/**
+ * @brief Fills a buffer with the AES-CTR keystream, e.g. to generate large amounts of pseudo-random data.
+ * 
+ * The output is the CTR encryption of zeroes, so it is only as unpredictable as the key and iv are.
+ * Aligned buffers are written with non-temporal stores, which keeps multi-GB fills close to memset speed.
+ * 
+ * @param dest Pointer to the output buffer, of at least length bytes.
+ * @param length Number of bytes to generate.
+ * @param iv The 16 bytes initial counter block.
+ * @param counter_offset Index of the first block relative to iv.
+ * @param num_threads Number of threads to use.
+ */
+void FastAES::generate_keystream(uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset, uint32_t num_threads) noexcept
+{
+    ctr_process(nullptr, dest, length, iv, counter_offset, num_threads);
+}
+
+/**
+ * @brief CTR mode kernel shared by ctr_crypt() and generate_keystream(), a null src stands for zeroes.
+ */
+void FastAES::ctr_process(const uint8_t* src, uint8_t* dest, std::size_t length, const uint8_t* iv, uint64_t counter_offset, uint32_t num_threads) noexcept
+{
+    if (length == 0)
+        return;
+
+    uint64_t iv_hi, iv_lo;
+    std::memcpy(&iv_hi, iv, 8);
+    std::memcpy(&iv_lo, iv + 8, 8);
+    iv_hi = __builtin_bswap64(iv_hi);
+    iv_lo = __builtin_bswap64(iv_lo);
+    const uint64_t base_lo = iv_lo + counter_offset;
+    const uint64_t base_hi = iv_hi + (base_lo < iv_lo);
+
+    auto thread_func = [&](std::size_t start, std::size_t end, const uint8_t* enc_key_schedule_ptr)
+    {
+        const __m128i* _enc_key_schedule_vector = reinterpret_cast<const __m128i*>(enc_key_schedule_ptr);
+        const std::size_t full_blocks = length / 16;
+        const bool stream = src == nullptr and (reinterpret_cast<uintptr_t>(dest) & 15) == 0;
+
+        if (bitsliced)
+        {
+            // counter blocks are encrypted in batches, a multiple of the blocks per bitsliced pass
+            alignas(16) uint8_t keystream[16 * 64];
+            for (std::size_t i = start; i < end; i += 64)
+            {
+                const std::size_t n = std::min<std::size_t>(64, end - i);
+                for (std::size_t k = 0; k < n; ++k)
+                    _mm_store_si128(reinterpret_cast<__m128i*>(keystream + 16*k), counter_block(base_hi, base_lo, i + k));
+                bitsliced->encrypt_blocks(keystream, keystream, n);
+
+                const std::size_t bytes = std::min<std::size_t>(16*n, length - 16*i);
+                std::size_t j = 0;
+                if (src == nullptr)
+                    std::memcpy(dest + 16*i, keystream, bytes);
+                else
+                {
+                    for (; j + 16 <= bytes; j += 16)
+                    {
+                        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16*i + j));
+                        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 16*i + j), _mm_xor_si128(data, _mm_load_si128(reinterpret_cast<const __m128i*>(keystream + j))));
+                    }
+                    for (; j < bytes; ++j)
+                        dest[16*i + j] = src[16*i + j] ^ keystream[j];
+                }
+            }
+            return;
+        }
+
+        // 8 independent blocks per pass to keep the AES unit pipeline busy
+        std::size_t i = start;
+        for (; i + 8 <= end and i + 8 <= full_blocks; i += 8)
+        {
+            __m128i stage[8];
+            for (int k = 0; k < 8; ++k)
+                stage[k] = _mm_xor_si128(counter_block(base_hi, base_lo, i + k), _enc_key_schedule_vector[0]);
+            for (int j = 1; j < 10; ++j)
+                for (int k = 0; k < 8; ++k)
+                    stage[k] = _mm_aesenc_si128(stage[k], _enc_key_schedule_vector[j]);
+            for (int k = 0; k < 8; ++k)
+            {
+                stage[k] = _mm_aesenclast_si128(stage[k], _enc_key_schedule_vector[10]);
+                __m128i* out = reinterpret_cast<__m128i*>(dest + 16*(i + k));
+                if (src != nullptr)
+                    _mm_storeu_si128(out, _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16*(i + k))), stage[k]));
+                else if (stream)
+                    _mm_stream_si128(out, stage[k]);
+                else
+                    _mm_storeu_si128(out, stage[k]);
+            }
+        }
+        if (stream)
+            _mm_sfence();
+
+        for (; i < end; ++i)
+        {
+            __m128i keystream = encrypt_block(counter_block(base_hi, base_lo, i), _enc_key_schedule_vector);
+            if (i < full_blocks)
+            {
+                __m128i data = src != nullptr ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16*i)) : _mm_setzero_si128();
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 16*i), _mm_xor_si128(data, keystream));
+            }
+            else
+            {
+                alignas(16) uint8_t tail[16] = {0};
+                const std::size_t tail_length = length - 16*i;
+                if (src != nullptr)
+                    std::memcpy(tail, src + 16*i, tail_length);
+                _mm_store_si128(reinterpret_cast<__m128i*>(tail), _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i*>(tail)), keystream));
+                std::memcpy(dest + 16*i, tail, tail_length);
+            }
+        }
+    };
+
+    std::size_t iter = length / 16 + (length%16 != 0);
+    num_threads = static_cast<uint32_t>(std::min<std::size_t>(iter, num_threads == 0 ? 1 : num_threads));
+
+    const std::size_t block_per_thread = iter / num_threads;
+    const std::size_t remainder_blocks = iter % num_threads;
+
+    std::size_t start = 0;
+    std::vector<std::thread> threads;
+    const uint8_t* enc_key_schedule_ptr = enc_key_schedule.get();
+    for (uint32_t i = 0; i < num_threads; ++i)
+    {
+        std::size_t end = start + block_per_thread + (i < remainder_blocks ? 1 : 0);
+        if (i + 1 == num_threads)
+            thread_func(start, end, enc_key_schedule_ptr);
+        else
+            threads.emplace_back(thread_func, start, end, enc_key_schedule_ptr);
+        start = end;
+    }
+
+    for (auto &thread : threads)
+        if (thread.joinable())
+            thread.join();
+}
+
+/**
+ * @brief Computes the AES-CMAC (RFC 4493) of a message.
+ * 
+ * @param msg Pointer to the message.
+ * @param length Length of the message in bytes, may be 0.
+ * @param tag Pointer to the 16 bytes output buffer receiving the tag.
+ */
+void FastAES::cmac(const uint8_t* msg, std::size_t length, uint8_t* tag) noexcept
+{
+    const __m128i* _enc_key_schedule_vector = reinterpret_cast<const __m128i*>(enc_key_schedule.get());
+    auto encrypt_one = [&](__m128i block) -> __m128i
+    {
+        if (not bitsliced)
+            return encrypt_block(block, _enc_key_schedule_vector);
+
+        alignas(16) uint8_t buffer[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(buffer), block);
+        bitsliced->encrypt_blocks(buffer, buffer, 1);
+        return _mm_load_si128(reinterpret_cast<const __m128i*>(buffer));
+    };
+
+    const std::size_t blocks = cmac_blocks(length);
+    __m128i state = _mm_setzero_si128();
+    for (std::size_t i = 0; i + 1 < blocks; ++i)
+        state = encrypt_one(_mm_xor_si128(state, _mm_loadu_si128(reinterpret_cast<const __m128i*>(msg + 16*i))));
+
+    state = _mm_xor_si128(state, cmac_last_block(msg, length, cmac_subkeys));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(tag), encrypt_one(state));
+}
+
+/**
+ * @brief Computes the AES-CMAC of a batch of messages.
+ * 
+ * CMAC being a serial chain within a message, up to 8 messages (16 with the AVX2 bitsliced engine) are
+ * processed side by side, one block of each per pass, so that the AES unit pipeline stays full. The batch
+ * is split across threads by contiguous ranges of messages.
+ * 
+ * @param msgs Pointers to the messages.
+ * @param lengths Lengths of the messages in bytes, each may be 0.
+ * @param count Number of messages.
+ * @param tags Pointer to the 16 * count bytes output buffer, tag i being stored at tags + 16 * i.
+ * @param num_threads Number of threads to use.
+ */
+void FastAES::cmac_batch(const uint8_t* const* msgs, const std::size_t* lengths, std::size_t count, uint8_t* tags, uint32_t num_threads) noexcept
+{
+    if (count == 0)
+        return;
+
+    const std::size_t lanes = bitsliced ? bitsliced->blocks_per_pass() : 8;
+    auto thread_func = [&](std::size_t first, std::size_t last, const uint8_t* enc_key_schedule_ptr)
+    {
+        const __m128i* _enc_key_schedule_vector = reinterpret_cast<const __m128i*>(enc_key_schedule_ptr);
+        if (lanes == 16)
+            cmac_lanes<16>(msgs, lengths, first, last, tags, _enc_key_schedule_vector, bitsliced.get(), cmac_subkeys);
+        else
+            cmac_lanes<8>(msgs, lengths, first, last, tags, _enc_key_schedule_vector, bitsliced.get(), cmac_subkeys);
+    };
+
+    // every thread should get enough messages to fill its lanes
+    const std::size_t max_threads = std::max<std::size_t>(1, count / lanes);
+    num_threads = static_cast<uint32_t>(std::min<std::size_t>(max_threads, num_threads == 0 ? 1 : num_threads));
+
+    const std::size_t msg_per_thread = count / num_threads;
+    const std::size_t remainder_msgs = count % num_threads;
+
+    std::size_t start = 0;
+    std::vector<std::thread> threads;
+    const uint8_t* enc_key_schedule_ptr = enc_key_schedule.get();
+    for (uint32_t i = 0; i < num_threads; ++i)
+    {
+        std::size_t end = start + msg_per_thread + (i < remainder_msgs ? 1 : 0);
+        if (i + 1 == num_threads)
+            thread_func(start, end, enc_key_schedule_ptr);
+        else
+            threads.emplace_back(thread_func, start, end, enc_key_schedule_ptr);
+        start = end;
+    }
+
+    for (auto &thread : threads)
+        if (thread.joinable())
+            thread.join();
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#include <cerrno>
+
+#ifdef _WIN32
+#include <io.h>
+#include <mutex>
+#else
+#include <unistd.h>
+#endif
+
+#include "../include/FdIO.hpp"
+
+#ifdef _WIN32
+static std::mutex seek_mutex;
+#endif
+
+/**
+ * @brief Reads from a file descriptor until the buffer is full or the end of the stream is reached.
+ *
+ * Pipes may return fewer bytes than requested, so a short count only means end of stream here.
+ *
+ * @return The number of bytes read, or -1 on error.
+ */
+long long read_full(int fd, uint8_t* buffer, std::size_t length) noexcept
+{
+    std::size_t total = 0;
+    while (total < length)
+    {
+        auto n = ::read(fd, buffer + total, length - total);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        total += n;
+    }
+
+    return total;
+}
+
+/**
+ * @brief Reads from a seekable file descriptor at an absolute offset, without moving its file position.
+ *
+ * Safe to call concurrently on the same descriptor.
+ *
+ * @return The number of bytes read (less than length only at end of file), or -1 on error.
+ */
+long long pread_full(int fd, uint8_t* buffer, std::size_t length, uint64_t offset) noexcept
+{
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(seek_mutex);
+    if (_lseeki64(fd, offset, SEEK_SET) < 0)
+        return -1;
+    return read_full(fd, buffer, length);
+#else
+    std::size_t total = 0;
+    while (total < length)
+    {
+        auto n = ::pread(fd, buffer + total, length - total, offset + total);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        total += n;
+    }
+
+    return total;
+#endif
+}
+
+/**
+ * @brief Writes a whole buffer to a file descriptor, retrying on partial writes.
+ *
+ * @return true if every byte was written, false on error.
+ */
+bool write_full(int fd, const uint8_t* buffer, std::size_t length) noexcept
+{
+    std::size_t total = 0;
+    while (total < length)
+    {
+        auto n = ::write(fd, buffer + total, length - total);
+        if (n < 0 and errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        total += n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Returns the size of the file behind a seekable file descriptor.
+ *
+ * @return The size in bytes, or -1 if the descriptor is not seekable (e.g. a pipe).
+ */
+long long file_size(int fd) noexcept
+{
+#ifdef _WIN32
+    std::lock_guard<std::mutex> lock(seek_mutex);
+    return _lseeki64(fd, 0, SEEK_END);
+#else
+    return ::lseek(fd, 0, SEEK_END);
+#endif
+}
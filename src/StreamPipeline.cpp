@@ -0,0 +1,196 @@
+#include <cstring>
+
+#include "../include/FdIO.hpp"
+#include "../include/StreamPipeline.hpp"
+
+constexpr std::size_t StreamPipeline::DEFAULT_CHUNK_SIZE;
+constexpr std::size_t StreamPipeline::DEFAULT_DEPTH;
+
+/**
+ * @brief Constructs a pipeline between two file descriptors.
+ *
+ * @param aes The FastAES instance used to encrypt or decrypt every chunk.
+ * @param in_fd File descriptor the input is read from (e.g. 0 for stdin).
+ * @param out_fd File descriptor the output is written to (e.g. 1 for stdout).
+ * @param chunk_size Size in bytes of each chunk, rounded down to a multiple of 16.
+ * @param depth Number of chunk buffers in flight, which bounds memory usage to about depth * chunk_size.
+ * @param num_threads Number of threads used to process each chunk.
+ */
+StreamPipeline::StreamPipeline(FastAES& aes, int in_fd, int out_fd, std::size_t chunk_size, std::size_t depth, uint32_t num_threads)
+    : aes(aes), in_fd(in_fd), out_fd(out_fd), chunk_size(chunk_size < 16 ? 16 : chunk_size & ~std::size_t(15)), depth(depth < 2 ? 2 : depth),
+      num_threads(num_threads == 0 ? 1 : num_threads), status(static_cast<int>(STATUS::OK))
+{
+}
+
+/**
+ * @brief Encrypts the whole input stream and PKCS5 pads its last block.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+StreamPipeline::STATUS StreamPipeline::encrypt()
+{
+    return run(true);
+}
+
+/**
+ * @brief Decrypts the whole input stream and strips the PKCS5 padding of its last block.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+StreamPipeline::STATUS StreamPipeline::decrypt()
+{
+    return run(false);
+}
+
+/**
+ * @brief Records the first failure and closes every queue so that all stages wind down.
+ */
+void StreamPipeline::fail(STATUS reason, BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept
+{
+    int expected = static_cast<int>(STATUS::OK);
+    status.compare_exchange_strong(expected, static_cast<int>(reason));
+    free_q.close();
+    filled_q.close();
+    done_q.close();
+}
+
+/**
+ * @brief Reader stage, fills free chunks from the input and hands them to the processing stage.
+ *
+ * A full chunk is only handed over once the next read tells whether it was the last one,
+ * so that the processing stage knows which chunk to pad or unpad.
+ */
+void StreamPipeline::read_stage(BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept
+{
+    Chunk* current = nullptr;
+    if (not free_q.pop(current))
+        return;
+
+    long long n = read_full(in_fd, current->data.get(), chunk_size);
+    while (n >= 0)
+    {
+        current->length = n;
+        current->last = static_cast<std::size_t>(n) < chunk_size;
+        if (current->last)
+            break;
+
+        Chunk* next = nullptr;
+        if (not free_q.pop(next))
+            return;
+
+        n = read_full(in_fd, next->data.get(), chunk_size);
+        if (n == 0)
+        {
+            current->last = true;
+            free_q.push(next);
+            break;
+        }
+
+        if (not filled_q.push(current))
+            return;
+        current = next;
+    }
+
+    if (n < 0)
+    {
+        fail(STATUS::READ_ERROR, free_q, filled_q, done_q);
+        return;
+    }
+
+    filled_q.push(current);
+    filled_q.close();
+}
+
+/**
+ * @brief Writer stage, flushes processed chunks in order and recycles their buffers.
+ */
+void StreamPipeline::write_stage(BoundedQueue<Chunk*>& free_q, BoundedQueue<Chunk*>& filled_q, BoundedQueue<Chunk*>& done_q) noexcept
+{
+    Chunk* chunk = nullptr;
+    while (done_q.pop(chunk))
+    {
+        if (not write_full(out_fd, chunk->data.get(), chunk->length))
+        {
+            fail(STATUS::WRITE_ERROR, free_q, filled_q, done_q);
+            return;
+        }
+
+        free_q.push(chunk);
+    }
+}
+
+/**
+ * @brief Runs the reader, processing and writer stages until the input is exhausted or an error occurs.
+ *
+ * @param encrypt true to encrypt the stream, false to decrypt it.
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+StreamPipeline::STATUS StreamPipeline::run(bool encrypt)
+{
+    // every chunk keeps 16 extra bytes for the padding block of the last one
+    pool.clear();
+    pool.resize(depth);
+    for (auto& chunk : pool)
+    {
+        chunk.data.reset(new(std::nothrow) uint8_t[chunk_size + 16]);
+        if (chunk.data == nullptr)
+            return STATUS::ALLOC_ERROR;
+    }
+
+    BoundedQueue<Chunk*> free_q(depth), filled_q(depth), done_q(depth);
+    for (auto& chunk : pool)
+        free_q.push(&chunk);
+
+    status = static_cast<int>(STATUS::OK);
+    std::thread reader(&StreamPipeline::read_stage, this, std::ref(free_q), std::ref(filled_q), std::ref(done_q));
+    std::thread writer(&StreamPipeline::write_stage, this, std::ref(free_q), std::ref(filled_q), std::ref(done_q));
+
+    Chunk* chunk = nullptr;
+    while (filled_q.pop(chunk))
+    {
+        if (encrypt)
+        {
+            if (chunk->last)
+            {
+                std::size_t padding = 16 - chunk->length % 16;
+                std::memset(chunk->data.get() + chunk->length, static_cast<int>(padding), padding); // PCKS5 padding
+                chunk->length += padding;
+            }
+
+            aes.encrypt(chunk->data.get(), chunk->data.get(), chunk->length, num_threads);
+        }
+        else
+        {
+            if (chunk->length == 0 or chunk->length % 16 != 0)
+            {
+                fail(STATUS::BAD_LENGTH, free_q, filled_q, done_q);
+                break;
+            }
+
+            aes.decrypt(chunk->data.get(), chunk->data.get(), chunk->length, num_threads);
+            if (chunk->last)
+            {
+                const uint8_t* tail = chunk->data.get() + chunk->length;
+                const uint8_t padding = tail[-1];
+                bool valid = padding >= 1 and padding <= 16;
+                for (int i = 1; valid and i <= padding; ++i)
+                    valid = tail[-i] == padding;
+
+                if (not valid)
+                {
+                    fail(STATUS::BAD_PADDING, free_q, filled_q, done_q);
+                    break;
+                }
+                chunk->length -= padding;
+            }
+        }
+
+        if (not done_q.push(chunk))
+            break;
+    }
+    done_q.close();
+
+    reader.join();
+    writer.join();
+    return static_cast<STATUS>(status.load());
+}
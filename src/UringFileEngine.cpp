@@ -0,0 +1,509 @@
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include "../include/FdIO.hpp"
+#include "../include/UringFileEngine.hpp"
+
+constexpr std::size_t UringFileEngine::DEFAULT_CHUNK_SIZE;
+constexpr std::size_t UringFileEngine::ALIGNMENT;
+
+/**
+ * @brief Constructs an engine between two files, nothing is opened before encrypt() or decrypt() is called.
+ *
+ * @param aes The FastAES instance used to encrypt or decrypt every chunk.
+ * @param in_path Path of the input file.
+ * @param out_path Path of the output file, created or truncated.
+ * @param num_threads Number of worker threads, each one processing a whole chunk at a time.
+ * @param chunk_size Size in bytes of each chunk, rounded up to a multiple of ALIGNMENT.
+ */
+UringFileEngine::UringFileEngine(FastAES& aes, const char* in_path, const char* out_path, uint32_t num_threads, std::size_t chunk_size)
+    : aes(aes), in_path(in_path), out_path(out_path), num_threads(num_threads == 0 ? 1 : num_threads),
+      chunk_size(chunk_size < ALIGNMENT ? ALIGNMENT : (chunk_size + ALIGNMENT - 1) & ~(ALIGNMENT - 1)),
+      depth(2 * this->num_threads + 4), status(static_cast<int>(STATUS::OK)), inflight(0)
+{
+}
+
+UringFileEngine::~UringFileEngine()
+{
+    release();
+}
+
+/**
+ * @brief Encrypts the whole input file and PKCS5 pads its last block.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+UringFileEngine::STATUS UringFileEngine::encrypt()
+{
+    return run(true);
+}
+
+/**
+ * @brief Decrypts the whole input file and strips the PKCS5 padding of its last block.
+ *
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+UringFileEngine::STATUS UringFileEngine::decrypt()
+{
+    return run(false);
+}
+
+#ifdef __linux__
+
+/**
+ * @brief Creates the ring and maps its submission and completion queues, liburing is not required.
+ * Also creates the eventfd that wakes up the completion loop on failure.
+ *
+ * @return false if the kernel does not support io_uring or forbids its use.
+ */
+bool UringFileEngine::setup_ring() noexcept
+{
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0)
+        return false;
+
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, static_cast<unsigned>(depth + 2), &params));
+    if (ring_fd < 0)
+        return false;
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+        sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED)
+    {
+        sq_ring = nullptr;
+        return false;
+    }
+
+    cq_ring = single_mmap ? sq_ring : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ring == MAP_FAILED)
+    {
+        cq_ring = nullptr;
+        return false;
+    }
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        sqes = nullptr;
+        return false;
+    }
+
+    uint8_t* sq = static_cast<uint8_t*>(sq_ring);
+    uint8_t* cq = static_cast<uint8_t*>(cq_ring);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = cq + params.cq_off.cqes;
+    return true;
+}
+
+/**
+ * @brief Unmaps the ring, closes both files and frees the buffers. No operation may be in flight.
+ */
+void UringFileEngine::release() noexcept
+{
+    if (sqes != nullptr)
+        munmap(sqes, sqes_size);
+    if (cq_ring != nullptr and cq_ring != sq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring != nullptr)
+        munmap(sq_ring, sq_ring_size);
+    sqes = cq_ring = sq_ring = nullptr;
+
+    // closing the ring also unregisters the buffers
+    for (int* fd : {&ring_fd, &wake_fd, &in_fd, &out_fd})
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+
+    if (not leak_buffers)
+        std::free(buffers);
+    buffers = nullptr;
+    leak_buffers = false;
+    delete[] iovecs;
+    iovecs = nullptr;
+    slots.clear();
+}
+
+/**
+ * @brief Queues a single operation and hands it to the kernel, may be called from any thread.
+ *
+ * @param opcode IORING_OP_* code of the operation.
+ * @param slot Index of the buffer slot, returned as the completion user_data.
+ * @param buffer Start of the transfer, inside the buffer of the slot.
+ * @return false if the kernel rejected the submission.
+ */
+bool UringFileEngine::submit(uint8_t opcode, std::size_t slot, int fd, uint8_t* buffer, std::size_t length, uint64_t offset) noexcept
+{
+    std::lock_guard<std::mutex> lock(submit_mutex);
+    const unsigned tail = *sq_tail;
+    const unsigned index = tail & *sq_mask;
+    io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes) + index;
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->user_data = slot;
+    if (opcode == IORING_OP_READ_FIXED or opcode == IORING_OP_WRITE_FIXED)
+    {
+        sqe->addr = reinterpret_cast<uint64_t>(buffer);
+        sqe->len = static_cast<uint32_t>(length);
+        sqe->buf_index = static_cast<uint16_t>(slot);
+    }
+    else if (opcode == IORING_OP_READV or opcode == IORING_OP_WRITEV)
+    {
+        iovecs[slot].iov_base = buffer;
+        iovecs[slot].iov_len = length;
+        sqe->addr = reinterpret_cast<uint64_t>(&iovecs[slot]);
+        sqe->len = 1;
+    }
+
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++inflight;
+
+    long submitted = 0;
+    do
+        submitted = syscall(__NR_io_uring_enter, ring_fd, 1, 0, 0, nullptr, 0);
+    while (submitted < 0 and errno == EINTR);
+
+    if (submitted != 1)
+    {
+        __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+        --inflight;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Waits for the next completion, only called from the thread running run().
+ *
+ * The ring and the wake-up eventfd are polled together, so that a failure recorded by fail() interrupts
+ * the wait even when no operation is in flight or when the ring itself stopped accepting submissions.
+ *
+ * @param slot Receives the user_data of the completed operation.
+ * @param result Receives its result, the number of bytes transferred or a negated errno.
+ * @param wakeable Whether a recorded failure ends the wait, false to wait for the completion regardless.
+ * @return false if no completion was reaped, because of a recorded failure or of a polling error.
+ */
+bool UringFileEngine::reap(uint64_t& slot, int& result, bool wakeable) noexcept
+{
+    for (;;)
+    {
+        const unsigned head = *cq_head;
+        if (head != __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE))
+        {
+            const io_uring_cqe* cqe = static_cast<const io_uring_cqe*>(cqes) + (head & *cq_mask);
+            slot = cqe->user_data;
+            result = cqe->res;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            --inflight;
+            return true;
+        }
+
+        if (wakeable and status.load() != static_cast<int>(STATUS::OK))
+            return false;
+
+        // the ring reports POLLIN as soon as its completion queue is not empty
+        pollfd fds[2] = {{ring_fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+        if (poll(fds, wakeable ? 2 : 1, -1) < 0 and errno != EINTR)
+            return false;
+        if ((fds[0].revents | (wakeable ? fds[1].revents : 0)) & (POLLERR | POLLNVAL))
+            return false;
+    }
+}
+
+/**
+ * @brief Submits the read or the write of a slot, resuming after the bytes already transferred.
+ *
+ * Transfers are rounded up to ALIGNMENT as O_DIRECT requires. Reads stop short at the end of the input,
+ * and the output is truncated to its exact size once every write completed.
+ */
+bool UringFileEngine::submit_io(std::size_t slot) noexcept
+{
+    Slot& s = slots[slot];
+    const bool reading = s.state == SLOT_STATE::READING;
+    const std::size_t total = (s.length + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    uint8_t opcode = 0;
+    if (fixed_buffers)
+        opcode = reading ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+    else
+        opcode = reading ? IORING_OP_READV : IORING_OP_WRITEV;
+
+    return submit(opcode, slot, reading ? in_fd : out_fd, s.data + s.io_done, total - s.io_done, s.offset + s.io_done);
+}
+
+/**
+ * @brief Records the first failure and wakes up the completion loop through the eventfd, which does not
+ * depend on the ring accepting submissions.
+ */
+void UringFileEngine::fail(STATUS reason) noexcept
+{
+    int expected = static_cast<int>(STATUS::OK);
+    if (status.compare_exchange_strong(expected, static_cast<int>(reason)))
+    {
+        // an eventfd write only fails once its counter overflows, the loop is awake by then anyway
+        const uint64_t one = 1;
+        const ssize_t written = write(wake_fd, &one, sizeof(one));
+        (void)written;
+    }
+}
+
+/**
+ * @brief Worker thread, encrypts or decrypts the chunks whose read completed and submits their writes.
+ */
+void UringFileEngine::process_stage(BoundedQueue<std::size_t>& filled_q, bool encrypt) noexcept
+{
+    std::size_t slot = 0;
+    while (filled_q.pop(slot))
+    {
+        if (status.load() != static_cast<int>(STATUS::OK))
+            continue;
+
+        Slot& s = slots[slot];
+        if (encrypt)
+        {
+            if (s.last)
+            {
+                const std::size_t pad = 16 - s.length % 16;
+                std::memset(s.data + s.length, static_cast<int>(pad), pad); // PCKS5 padding
+                s.length += pad;
+            }
+
+            aes.encrypt(s.data, s.data, s.length, 1);
+        }
+        else
+        {
+            aes.decrypt(s.data, s.data, s.length, 1);
+            if (s.last)
+            {
+                const uint8_t* tail = s.data + s.length;
+                const uint8_t pad = tail[-1];
+                bool valid = pad >= 1 and pad <= 16;
+                for (int i = 1; valid and i <= pad; ++i)
+                    valid = tail[-i] == pad;
+
+                if (not valid)
+                {
+                    fail(STATUS::BAD_PADDING);
+                    continue;
+                }
+                padding = pad;
+            }
+        }
+
+        s.state = SLOT_STATE::WRITING;
+        s.io_done = 0;
+        if (not submit_io(slot))
+            fail(STATUS::WRITE_ERROR);
+    }
+}
+
+/**
+ * @brief Opens both files, then drives the reads and writes of every slot until the whole input is processed.
+ *
+ * Chunk i is read from and written to offset i * chunk_size, so the slots complete in any order.
+ *
+ * @param encrypt true to encrypt the file, false to decrypt it.
+ * @return STATUS::OK on success, the reason of the failure otherwise.
+ */
+UringFileEngine::STATUS UringFileEngine::run(bool encrypt)
+{
+    release();
+    if (not setup_ring())
+    {
+        release();
+        return STATUS::UNAVAILABLE;
+    }
+
+    in_fd = open(in_path, O_RDONLY | O_DIRECT);
+    if (in_fd < 0 and errno == EINVAL)
+        in_fd = open(in_path, O_RDONLY);
+    if (in_fd < 0)
+    {
+        release();
+        return STATUS::INPUT_OPEN_ERROR;
+    }
+
+    const long long input_size = file_size(in_fd);
+    if (input_size < 0)
+    {
+        release();
+        return STATUS::READ_ERROR;
+    }
+    if (not encrypt and (input_size == 0 or input_size % 16 != 0))
+    {
+        release();
+        return STATUS::BAD_LENGTH;
+    }
+
+    out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (out_fd < 0 and errno == EINVAL)
+        out_fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd < 0)
+    {
+        release();
+        return STATUS::OUTPUT_OPEN_ERROR;
+    }
+
+    // every slot keeps room for the padding block of the last chunk, rounded up to the alignment
+    const std::size_t slot_size = chunk_size + ALIGNMENT;
+    void* memory = nullptr;
+    iovecs = new(std::nothrow) iovec[depth];
+    if (iovecs == nullptr or posix_memalign(&memory, ALIGNMENT, depth * slot_size) != 0)
+    {
+        release();
+        return STATUS::ALLOC_ERROR;
+    }
+    buffers = static_cast<uint8_t*>(memory);
+
+    slots.resize(depth);
+    for (std::size_t i = 0; i < depth; ++i)
+    {
+        slots[i].data = buffers + i * slot_size;
+        iovecs[i].iov_base = slots[i].data;
+        iovecs[i].iov_len = slot_size;
+    }
+
+    // pinning the buffers saves a page walk per transfer, but may exceed RLIMIT_MEMLOCK
+    fixed_buffers = syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovecs, static_cast<unsigned>(depth)) == 0;
+
+    const uint64_t chunk_count = encrypt ? input_size / chunk_size + 1 : (input_size + chunk_size - 1) / chunk_size;
+    status = static_cast<int>(STATUS::OK);
+    inflight = 0;
+    padding = 0;
+
+    BoundedQueue<std::size_t> filled_q(depth);
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < num_threads; ++i)
+        workers.emplace_back(&UringFileEngine::process_stage, this, std::ref(filled_q), encrypt);
+
+    uint64_t next_chunk = 0;
+    auto start_chunk = [&](std::size_t slot)
+    {
+        Slot& s = slots[slot];
+        s.offset = next_chunk * chunk_size;
+        s.length = std::min<uint64_t>(chunk_size, input_size - s.offset);
+        s.last = ++next_chunk == chunk_count;
+        s.io_done = 0;
+        s.state = SLOT_STATE::READING;
+        if (s.length == 0) // empty last chunk of an encryption, only made of padding
+        {
+            s.state = SLOT_STATE::PROCESSING;
+            filled_q.push(slot);
+        }
+        else if (not submit_io(slot))
+            fail(STATUS::READ_ERROR);
+    };
+
+    for (std::size_t slot = 0; slot < depth and next_chunk < chunk_count; ++slot)
+        start_chunk(slot);
+
+    uint64_t completed = 0;
+    while (completed < chunk_count and status.load() == static_cast<int>(STATUS::OK))
+    {
+        uint64_t slot = 0;
+        int result = 0;
+        if (not reap(slot, result, true))
+        {
+            fail(STATUS::READ_ERROR);
+            break;
+        }
+
+        Slot& s = slots[slot];
+        const bool reading = s.state == SLOT_STATE::READING;
+        if (result <= 0)
+        {
+            fail(reading ? STATUS::READ_ERROR : STATUS::WRITE_ERROR);
+            continue;
+        }
+
+        s.io_done += result;
+        if (s.io_done < s.length)
+        {
+            if (not submit_io(slot))
+                fail(reading ? STATUS::READ_ERROR : STATUS::WRITE_ERROR);
+            continue;
+        }
+
+        if (reading)
+        {
+            s.state = SLOT_STATE::PROCESSING;
+            filled_q.push(slot);
+        }
+        else
+        {
+            ++completed;
+            if (next_chunk < chunk_count)
+                start_chunk(slot);
+        }
+    }
+
+    filled_q.close();
+    for (auto& worker : workers)
+        worker.join();
+
+    // the buffers must outlive every operation still owned by the kernel, they are leaked if the ring cannot be drained
+    while (inflight.load() > 0)
+    {
+        uint64_t slot = 0;
+        int result = 0;
+        if (not reap(slot, result, false))
+        {
+            fail(STATUS::READ_ERROR);
+            leak_buffers = true;
+            break;
+        }
+    }
+
+    STATUS result = static_cast<STATUS>(status.load());
+    if (result == STATUS::OK)
+    {
+        const uint64_t output_size = encrypt ? (input_size / 16 + 1) * 16 : input_size - padding;
+        if (ftruncate(out_fd, output_size) != 0)
+            result = STATUS::WRITE_ERROR;
+    }
+
+    release();
+    return result;
+}
+
+#else
+
+void UringFileEngine::release() noexcept
+{
+}
+
+UringFileEngine::STATUS UringFileEngine::run(bool encrypt)
+{
+    return STATUS::UNAVAILABLE;
+}
+
+#endif
@@ -1,21 +1,28 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <memory>
 #include <random>
 #include <cstring>
+#include <numeric>
 
 #include "../include/FastAES.hpp"
 
-std::vector<uint8_t> generate_random_data(size_t size)
+std::unique_ptr<uint8_t[]> generate_random_data(size_t size)
 {
-    std::vector<uint8_t> data(size);
+    // AES-CTR keystream under a random key and iv, the whole buffer is filled by every core at once.
+    // The buffer is left uninitialized so that its pages are first touched by the generator threads.
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
     std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<uint8_t> dis(0, 255);
-
-    for (auto &byte : data)
-        byte = dis(gen);
+    alignas(16) uint8_t seed[32];
+    for (int i = 0; i < 32; i += 4)
+    {
+        uint32_t word = rd();
+        std::memcpy(seed + i, &word, 4);
+    }
 
+    FastAES generator(seed);
+    generator.generate_keystream(data.get(), size, seed + 16);
     return data;
 }
 
@@ -45,14 +52,17 @@ void benchmark_aes(FastAES &aes, const uint8_t *data, size_t data_size, bool enc
     mean_rate /= times.size();
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    // -bitsliced benchmarks the software engine, even on CPUs with AES-NI
+    const bool bitsliced = argc > 1 and !std::strcmp(argv[1], "-bitsliced");
     std::vector<size_t> sizes = {512ULL * 1024 * 1024, 1ULL * 1024 * 1024 * 1024, 2ULL * 1024 * 1024 * 1024};
     uint8_t key[16] = {0xa1, 0xff, 0x03, 0x01,
                        0x00, 0x02, 0x05, 0xf2,
                        0x2A, 0xF3, 0xF4, 0xD4,
                        0xB1, 0x32, 0x4F, 0xDF};
-    FastAES aes(key);
+    FastAES aes(key, bitsliced ? FastAES::ENGINE::BITSLICED : FastAES::ENGINE::AUTO);
+    std::cout << "Engine: " << (aes.get_engine() == FastAES::ENGINE::AESNI ? "AES-NI" : "bitsliced") << std::endl;
 
     for (size_t size : sizes)
     {
@@ -63,12 +73,11 @@ int main()
         double decrypt_mean_time = 0.0;
         double decrypt_mean_rate = 0.0;
 
+        auto data = generate_random_data(size);
         for (int i = 0; i < 10; ++i)
         {
-            auto data = generate_random_data(size);
-
-            benchmark_aes(aes, data.data(), size, true, std::thread::hardware_concurrency(), encrypt_mean_time, encrypt_mean_rate);
-            benchmark_aes(aes, data.data(), size, false, std::thread::hardware_concurrency(), decrypt_mean_time, decrypt_mean_rate);
+            benchmark_aes(aes, data.get(), size, true, std::thread::hardware_concurrency(), encrypt_mean_time, encrypt_mean_rate);
+            benchmark_aes(aes, data.get(), size, false, std::thread::hardware_concurrency(), decrypt_mean_time, decrypt_mean_rate);
 
             std::cout << "Run " << (i + 1) << ":\n";
             std::cout << "  Encryption - Mean Time: " << encrypt_mean_time << " seconds, Mean Rate: " << encrypt_mean_rate << " MB/s\n";
@@ -3,20 +3,28 @@
 #include <iostream>
 #include <chrono>
 #include <vector>
+#include <memory>
 #include <random>
 #include <cstring>
 #include <numeric>
 
-std::vector<uint8_t> generate_random_data(size_t size)
+#include "../include/FastAES.hpp"
+
+std::unique_ptr<uint8_t[]> generate_random_data(size_t size)
 {
-    std::vector<uint8_t> data(size);
+    // AES-CTR keystream under a random key and iv, the whole buffer is filled by every core at once.
+    // The buffer is left uninitialized so that its pages are first touched by the generator threads.
+    std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
     std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<int> dis(0, 255);
-
-    for (auto& byte : data)
-        byte = static_cast<uint8_t>(dis(gen));
+    alignas(16) uint8_t seed[32];
+    for (int i = 0; i < 32; i += 4)
+    {
+        uint32_t word = rd();
+        std::memcpy(seed + i, &word, 4);
+    }
 
+    FastAES generator(seed);
+    generator.generate_keystream(data.get(), size, seed + 16);
     return data;
 }
 
@@ -95,12 +103,11 @@ int main()
         double decrypt_mean_time = 0.0;
         double decrypt_mean_rate = 0.0;
 
+        auto data = generate_random_data(size);
         for (int i = 0; i < 10; ++i)
         {
-            auto data = generate_random_data(size);
-
-            benchmark_openssl_aes(data.data(), size, true, key, encrypt_mean_time, encrypt_mean_rate);
-            benchmark_openssl_aes(data.data(), size, false, key, decrypt_mean_time, decrypt_mean_rate);
+            benchmark_openssl_aes(data.get(), size, true, key, encrypt_mean_time, encrypt_mean_rate);
+            benchmark_openssl_aes(data.get(), size, false, key, decrypt_mean_time, decrypt_mean_rate);
 
             std::cout << "Run " << (i + 1) << ":\n";
             std::cout << "  Encryption - Mean Time: " << encrypt_mean_time << " seconds, Mean Rate: " << encrypt_mean_rate << " MB/s\n";
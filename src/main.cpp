@@ -1,16 +1,55 @@
 #include <array>
-#include <iomanip>
+#include <vector>
+#include <string>
 #include <cstring>
+#include <algorithm>
+#include <stdexcept>
 #include <fstream>
 #include <iostream>
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
 
 #include "../include/FastAES.hpp"
+#include "../include/FdIO.hpp"
+#include "../include/Container.hpp"
+#include "../include/StreamPipeline.hpp"
+#include "../include/UringFileEngine.hpp"
 
 void print_hex(const uint8_t* data, std::size_t length)
 {
+    static const char digits[] = "0123456789abcdef";
+    std::string hex(2 * length, '0');
     for (std::size_t i = 0; i < length; ++i)
-        std::cout << std::setw(2) << std::setfill('0') << std::hex << static_cast<int>(data[i]);
-    std::cout << std::dec << std::endl;
+    {
+        hex[2 * i] = digits[data[i] >> 4];
+        hex[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+    std::cout << hex << std::endl;
+}
+
+/**
+ * @brief Opens a CLI file argument as a raw file descriptor, "-" standing for stdin or stdout.
+ *
+ * @return The file descriptor, or -1 if the file cannot be opened.
+ */
+int open_stream(const char* path, bool output)
+{
+    if (std::strcmp(path, "-"))
+        return output ? ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644) : ::open(path, O_RDONLY | O_BINARY);
+
+#ifdef _WIN32
+    _setmode(output ? 1 : 0, O_BINARY);
+#endif
+    return output ? 1 : 0;
 }
 
 uint8_t* hex_string_to_binary(const char* hex_str, size_t& out_size)
@@ -63,6 +102,36 @@ uint8_t* hex_string_to_binary(const char* hex_str, size_t& out_size)
     return binary_data;
 }
 
+/**
+ * @brief Reports a failed container operation on stderr.
+ */
+void print_container_error(Container::STATUS status)
+{
+    switch (status)
+    {
+        case Container::STATUS::OK:
+            break;
+        case Container::STATUS::ALLOC_ERROR:
+            std::cerr << "Error: Memory allocation failed for the container buffers. Ensure sufficient memory is available and try again.\n";
+            break;
+        case Container::STATUS::READ_ERROR:
+            std::cerr << "Error: Cannot read input file.\n";
+            break;
+        case Container::STATUS::WRITE_ERROR:
+            std::cerr << "Error: Cannot write to output file.\n";
+            break;
+        case Container::STATUS::BAD_FORMAT:
+            std::cerr << "Error: The input file is not a valid sm-aes container.\n";
+            break;
+        case Container::STATUS::BAD_RANGE:
+            std::cerr << "Error: The requested range lies outside of the container plaintext.\n";
+            break;
+        case Container::STATUS::BAD_TAG:
+            std::cerr << "Error : Bad Key provided for decryption, or the container has been tampered with.\n";
+            break;
+    }
+}
+
 void print_help() 
 {
     std::cout << "Usage: sm-aes.exe [options]\n"
@@ -71,8 +140,13 @@ void print_help()
               << "  -dec                  Decrypt the input\n"
               << "  -key <key>            Specify the encryption/decryption key (keys larger than 16 bytes will be truncated and smaller will be space padded)\n"
               << "  -msg <text>           Specify the plaintext message to encrypt (output could contain spaced extra bytes corresponding to Spaced padding bytes)\n"
-              << "  -in <file>            Specify the input file path\n"
-              << "  -out <file>           Specify the output file path (output could contain extra bytes corresponding to PKCS5 padding bytes)\n"
+              << "  -in <file>            Specify the input file path, or - to stream from stdin\n"
+              << "  -out <file>           Specify the output file path, or - to stream to stdout (output could contain extra bytes corresponding to PKCS5 padding bytes)\n"
+              << "  -container            Write (-enc) or read (-dec) the seekable chunked container format instead of raw ECB cyphertext\n"
+              << "  -tag                  With -enc -container, authenticate every chunk and the chunk index with AES-CMAC tags\n"
+              << "  -range <off>:<len>    With -dec -container, only decrypt <len> plaintext bytes starting at byte <off>\n"
+              << "  -uring                With -in and -out files, read and write through io_uring with O_DIRECT (Linux only, falls back to the default file mode when unavailable)\n"
+              << "  -bitsliced            Force the constant-time bitsliced software engine, used anyway when the CPU lacks AES-NI\n"
               << "  -thd <thread number>  Specify the number of threads to use for encryption/decryption. Defaults to the number of available CPU cores.\n"
               << "  -h                    Display this help message and exit\n"
 
@@ -84,7 +158,14 @@ void print_help()
               << "  Encrypt a file with a key and 4 threads:\n"
               << "    sm-aes.exe -enc -key mysecretkey123456 -in input.txt -out encrypted.bin -thd 4\n"
               << "  Decrypt a file with the same key and save the output to a text file:\n"
-              << "    sm-aes.exe -dec -key mysecretkey123456 -in encrypted.bin -out decrypted.txt\n";
+              << "    sm-aes.exe -dec -key mysecretkey123456 -in encrypted.bin -out decrypted.txt\n"
+              << "  Encrypt a large file with io_uring, bypassing the page cache:\n"
+              << "    sm-aes.exe -enc -key mysecretkey123456 -uring -in input.bin -out encrypted.bin\n"
+              << "  Encrypt a stream inside a shell pipeline:\n"
+              << "    tar -c dir | sm-aes.exe -enc -key mysecretkey123456 -in - -out - | zstd > dir.tar.enc.zst\n"
+              << "  Encrypt a file into an authenticated container, then decrypt 4096 bytes at offset 1000000 from it:\n"
+              << "    sm-aes.exe -enc -key mysecretkey123456 -container -tag -in input.bin -out input.smc\n"
+              << "    sm-aes.exe -dec -key mysecretkey123456 -container -range 1000000:4096 -in input.smc -out -\n";
 }
 
 int main(int argc, char* argv[]) 
@@ -93,7 +174,7 @@ int main(int argc, char* argv[])
         print_help();
 
     // args parsing
-    int enc{0}, dec{0}, msg{0}, in{0}, out{0}, key{0}, thd{0}, num_threads{0};
+    int enc{0}, dec{0}, msg{0}, in{0}, out{0}, key{0}, thd{0}, num_threads{0}, container{0}, tag{0}, range{0}, bitsliced{0}, uring{0};
     for (int i = 1; i < argc; ++i)
     {
         if (!std::strcmp(argv[i], "-h")) 
@@ -121,6 +202,16 @@ int main(int argc, char* argv[])
             out = ++i; // output file path position in arg-array
         else if (!std::strcmp(argv[i], "-thd"))
             thd = ++i; // thread number position in arg-array
+        else if (!std::strcmp(argv[i], "-container"))
+            container = 1;
+        else if (!std::strcmp(argv[i], "-tag"))
+            tag = 1;
+        else if (!std::strcmp(argv[i], "-range"))
+            range = ++i; // range position in arg-array
+        else if (!std::strcmp(argv[i], "-bitsliced"))
+            bitsliced = 1;
+        else if (!std::strcmp(argv[i], "-uring"))
+            uring = 1;
         else
         {
             std::cerr << "Error: Unknow option " << argv[i] << "\n";
@@ -195,12 +286,58 @@ int main(int argc, char* argv[])
         }
     }
 
+    if (container and not in)
+    {
+        std::cerr << "Error: The -container option requires the -in and -out options.\n";
+        return EXIT_FAILURE;
+    }
+    if (tag and not (container and enc))
+    {
+        std::cerr << "Error: The -tag option can only be used with -enc -container.\n";
+        return EXIT_FAILURE;
+    }
+    if (range and not (container and dec))
+    {
+        std::cerr << "Error: The -range option can only be used with -dec -container.\n";
+        return EXIT_FAILURE;
+    }
+    if (range and range >= argc)
+    {
+        std::cerr << "Error: You must specify the -range option followed by a valid <offset>:<length> value.\n";
+        return EXIT_FAILURE;
+    }
+    if (container and dec and not std::strcmp(argv[in], "-"))
+    {
+        std::cerr << "Error: Decrypting a container requires a seekable input file, not stdin.\n";
+        return EXIT_FAILURE;
+    }
+    if (uring and (not in or container or not std::strcmp(argv[in], "-") or not std::strcmp(argv[out], "-")))
+    {
+        std::cerr << "Error: The -uring option requires the -in and -out options with file paths, and cannot be used with -container.\n";
+        return EXIT_FAILURE;
+    }
+    uint64_t range_offset{0}, range_length{0};
+    if (range)
+    {
+        const char* separator = std::strchr(argv[range], ':');
+        try {
+            if (separator == nullptr or argv[range][0] == '-' or separator[1] == '-')
+                throw std::invalid_argument("range");
+            range_offset = std::stoull(std::string(argv[range], separator - argv[range]));
+            range_length = std::stoull(std::string(separator + 1));
+        }
+        catch(const std::exception& e) {
+            std::cerr << "Error: You must specify the -range option followed by a valid <offset>:<length> value.\n";
+            return EXIT_FAILURE;
+        }
+    }
+
     if (num_threads == 0)
         num_threads = std::thread::hardware_concurrency();
     alignas(16) uint8_t key_buff[16];
     std::memset(key_buff, ' ', 16);
     std::memcpy(key_buff, argv[key], std::strlen(argv[key]));
-    FastAES f_aes(key_buff);
+    FastAES f_aes(key_buff, bitsliced ? FastAES::ENGINE::BITSLICED : FastAES::ENGINE::AUTO);
     if (msg)
     {
         if (enc)
@@ -251,6 +388,143 @@ int main(int argc, char* argv[])
         return EXIT_SUCCESS;
     }
 
+    if (container)
+    {
+        int in_fd = open_stream(argv[in], false);
+        if (in_fd < 0)
+        {
+            std::cerr << "Error: Cannot open input file at path : " << argv[in] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        int out_fd = open_stream(argv[out], true);
+        if (out_fd < 0)
+        {
+            std::cerr << "Error: Cannot create output file at path : " << argv[out] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        if (enc)
+        {
+            ContainerWriter writer(f_aes, out_fd, Container::DEFAULT_CHUNK_SIZE, tag, num_threads);
+            std::vector<uint8_t> buffer(Container::DEFAULT_CHUNK_SIZE);
+            long long n = 0;
+            Container::STATUS status = Container::STATUS::OK;
+            do
+            {
+                n = read_full(in_fd, buffer.data(), buffer.size());
+                if (n < 0)
+                    status = Container::STATUS::READ_ERROR;
+                else
+                    status = writer.write(buffer.data(), n);
+            } while (status == Container::STATUS::OK and n == static_cast<long long>(buffer.size()));
+
+            if (status == Container::STATUS::OK)
+                status = writer.finish();
+            print_container_error(status);
+            return status == Container::STATUS::OK ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+
+        ContainerReader reader(f_aes, in_fd, num_threads);
+        Container::STATUS status = reader.open();
+        if (status == Container::STATUS::OK and not range)
+            range_length = reader.size();
+        if (status == Container::STATUS::OK and (range_offset > reader.size() or range_length > reader.size() - range_offset))
+            status = Container::STATUS::BAD_RANGE;
+
+        // decrypt through a bounded window spanning several chunks, so that every thread has work
+        std::vector<uint8_t> buffer;
+        if (status == Container::STATUS::OK)
+        {
+            const std::size_t window = std::max<std::size_t>(64 * 1024 * 1024 / reader.get_chunk_size(), num_threads) * reader.get_chunk_size();
+            buffer.resize(std::min<uint64_t>(window, range_length));
+        }
+        for (uint64_t done = 0; status == Container::STATUS::OK and done < range_length; )
+        {
+            const std::size_t n = std::min<uint64_t>(buffer.size(), range_length - done);
+            status = reader.read(range_offset + done, buffer.data(), n);
+            if (status == Container::STATUS::OK and not write_full(out_fd, buffer.data(), n))
+                status = Container::STATUS::WRITE_ERROR;
+            done += n;
+        }
+
+        print_container_error(status);
+        return status == Container::STATUS::OK ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    if (in and (not std::strcmp(argv[in], "-") or not std::strcmp(argv[out], "-")))
+    {
+        int in_fd = open_stream(argv[in], false);
+        if (in_fd < 0)
+        {
+            std::cerr << "Error: Cannot open input file at path : " << argv[in] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        int out_fd = open_stream(argv[out], true);
+        if (out_fd < 0)
+        {
+            std::cerr << "Error: Cannot create output file at path : " << argv[out] << "\n";
+            return EXIT_FAILURE;
+        }
+
+        StreamPipeline pipeline(f_aes, in_fd, out_fd, StreamPipeline::DEFAULT_CHUNK_SIZE, StreamPipeline::DEFAULT_DEPTH, num_threads);
+        switch (enc ? pipeline.encrypt() : pipeline.decrypt())
+        {
+            case StreamPipeline::STATUS::OK:
+                return EXIT_SUCCESS;
+            case StreamPipeline::STATUS::ALLOC_ERROR:
+                std::cerr << "Error: Memory allocation failed for the stream buffers. Ensure sufficient memory is available and try again.\n";
+                return EXIT_FAILURE;
+            case StreamPipeline::STATUS::READ_ERROR:
+                std::cerr << "Error: Cannot read input stream.\n";
+                return EXIT_FAILURE;
+            case StreamPipeline::STATUS::WRITE_ERROR:
+                std::cerr << "Error: Cannot write to output stream.\n";
+                return EXIT_FAILURE;
+            case StreamPipeline::STATUS::BAD_LENGTH:
+                std::cerr << "Error: Invalid input stream for decryption, its size must be a non-zero multiple of 16 bytes.\n";
+                return EXIT_FAILURE;
+            case StreamPipeline::STATUS::BAD_PADDING:
+                std::cerr << "Error : Bad Key provided for decryption.\n";
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (uring)
+    {
+        UringFileEngine engine(f_aes, argv[in], argv[out], num_threads);
+        switch (enc ? engine.encrypt() : engine.decrypt())
+        {
+            case UringFileEngine::STATUS::OK:
+                return EXIT_SUCCESS;
+            case UringFileEngine::STATUS::UNAVAILABLE:
+                std::cerr << "Warning: io_uring is not available on this system, falling back to the default file mode.\n";
+                break;
+            case UringFileEngine::STATUS::ALLOC_ERROR:
+                std::cerr << "Error: Memory allocation failed for the io_uring buffers. Ensure sufficient memory is available and try again.\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::INPUT_OPEN_ERROR:
+                std::cerr << "Error: Cannot open input file at path : " << argv[in] << "\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::OUTPUT_OPEN_ERROR:
+                std::cerr << "Error: Cannot create output file at path : " << argv[out] << "\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::READ_ERROR:
+                std::cerr << "Error: Cannot read input file.\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::WRITE_ERROR:
+                std::cerr << "Error: Cannot write to output file.\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::BAD_LENGTH:
+                std::cerr << "Error: Invalid input file for decryption, its size must be a non-zero multiple of 16 bytes.\n";
+                return EXIT_FAILURE;
+            case UringFileEngine::STATUS::BAD_PADDING:
+                std::cerr << "Error : Bad Key provided for decryption.\n";
+                return EXIT_FAILURE;
+        }
+    }
+
     if (in)
     {
         std::ofstream ofs(argv[out], std::ios::binary);